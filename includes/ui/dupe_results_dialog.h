@@ -15,7 +15,8 @@ class Dupe_results_dialog : public QDialog {
     Q_OBJECT
 
 public:
-    explicit Dupe_results_dialog(QWidget *parent, const MultiFileGroupArray& results, const FileQuantitySizeCounter& total_files);
+    // results are indexes into files, which must outlive the dialog
+    explicit Dupe_results_dialog(QWidget *parent, const MultiFile& files, const MultiFileGroupArray& results, const FileQuantitySizeCounter& total_files);
     ~Dupe_results_dialog();
 
 private:
@@ -26,8 +27,9 @@ private:
 
     ButtonGroupsPerTab button_groups_per_tab;
 
-    QMap<QAbstractButton*, File> button_to_file_map;
+    QMap<QAbstractButton*, quint32> button_to_file_map;
 
+    const MultiFile& files;
     MultiFileGroupArray allGroups;
     int current_group_index = 0;
 
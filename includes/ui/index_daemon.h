@@ -0,0 +1,48 @@
+#ifndef INDEX_DAEMON_H
+#define INDEX_DAEMON_H
+
+#include <QLocalServer>
+#include <QLocalSocket>
+#include <QJsonObject>
+#include <QSet>
+
+class MainWindow;
+
+// long running indexing daemon (disk_deduper --daemon), the window is never shown but keeps index.db
+// and the scan state open, so repeated queries skip start up and db open
+// the socket name is the daemon_socket setting
+//
+// requests and replies are JSON objects, one per line (the same framing as the shard workers)
+//     {"request": "scan", "mode": <scan mode name>, "folders": [...], "excluded": [...], "extensions": [...]}
+//     {"request": "duplicates"}                        Hash duplicates (from index)
+//     {"request": "similar", "similarity": <1-10>}     Find similar files
+//     {"request": "stats", "fields": [...]}            Show statistics
+//     {"request": "watch", "folders": [...]}           keeps the index current while files change (IndexWatcher)
+//     {"request": "unwatch"}, {"request": "status"}, {"request": "modes"}
+// folders default to the ones saved by the ui, every reply has "ok" (and "error" if it's false)
+// requests of one client are answered in order, scans of different clients are rejected while one runs
+class IndexDaemon {
+
+public:
+    explicit IndexDaemon(MainWindow* window);
+
+    IndexDaemon(const IndexDaemon&) = delete;
+    IndexDaemon& operator=(const IndexDaemon&) = delete;
+
+    // false if the socket can't be opened or another daemon is using it
+    bool listen();
+
+private:
+    // a running daemon accepts connections right away
+    static const int connect_timeout_ms = 1000;
+
+    MainWindow* window;
+    QLocalServer server;
+    // clients whose request is being answered, their next lines wait until it's done
+    QSet<QLocalSocket*> busy_clients;
+
+    void addClient(QLocalSocket* socket);
+    void readRequests(QLocalSocket* socket);
+};
+
+#endif // INDEX_DAEMON_H
@@ -25,10 +25,19 @@
 
 #include <QSettings>
 
+#include <QJsonObject>
+#include <QJsonArray>
+
 #include <functional>
 
 #include "gutils.h"
-#include "ExifTool.h"
+#include "ExifToolPool.h"
+#include "db_writer.h"
+#include "index_maintenance.h"
+#include "file_table.h"
+#include "flat_group_map.h"
+#include "external_sorter.h"
+#include "index_watcher.h"
 #include "folder_list_item.h"
 
 QT_BEGIN_NAMESPACE
@@ -54,20 +63,30 @@ public:
     ~MainWindow();
 
     void hashCompare(QSqlDatabase db);
+    void indexedHashCompare(QSqlDatabase db);
+    void externalHashCompare(QSqlDatabase db);
+    void shardedHashCompare(QSqlDatabase db);
     void phashCompare(QSqlDatabase db);
     void nameCompare(QSqlDatabase db);
     void autoDedupe_move(QSqlDatabase db);
     void autoDedupe_rename(QSqlDatabase db);
     void exifRename(QSqlDatabase);
     void showStats(QSqlDatabase db);
+    void indexMaintenance(QSqlDatabase db);
+    void exportCatalog(QSqlDatabase db);
 
     void fileCompare_display();
     void showStats_display();
     void autoDedupe_display();
+    void indexMaintenance_display();
 
     QString showStats_request();
     QString autoDedupe_request();
     QString exifRename_request();
+    QString exportCatalog_request();
+
+    // requests of the index daemon (see IndexDaemon), the reply always has "ok" and "error" if it's false
+    QJsonObject daemonRequest(const QJsonObject& request);
 
     // for displaying log messages in the ui
     static MainWindow *this_window;
@@ -77,8 +96,10 @@ public slots:
 
 private slots:
     void onAddScanFolderClicked();
+    void onAddCatalogClicked();
 
     void onSetMasterFolderClicked();
+    void onSetMasterCatalogClicked();
     void onSetDupesFolderClicked();
 
     void onCurrentModeChanged(int curr_mode);
@@ -118,18 +139,60 @@ private:
     QString callTextDialogue(const QString &title, const QString &prompt);
 
     template<FileField field>
-    void findDuplicateFiles(QSqlDatabase db);
+    void findDuplicateFiles();
+    // groups of indexed_files by radix sorting their keys (hash or name), instead of a map lookup per file
+    template<FileField field>
+    QVector<FileIndexes> sortDuplicateGroups();
+    // groups hold indexes into indexed_files
+    template<typename Key>
+    void addToDuplicateGroups(FlatGroupMap<Key, FileIndexes>& duplicate_files_map, const Key& value, quint32 index);
+    // groups with the same dupe locations are merged and rotated into dedupe_resuts
+    void buildDedupeResults(const QVector<FileIndexes>& duplicate_groups);
 
     void autoDedupe(QSqlDatabase db, bool safe);
 
+    // hashes the files whose keys repeat in input, and adds them to output keyed by size + hash
+    bool hashDuplicateKeys(ExternalSorter& input, ExternalSorter& output, File::HashType hash_type);
+    // files hashed at once by the out-of-core mode
+    static const int external_hash_batch_size = 4096;
+    // groups of paths with the same hash (out-of-core and sharded modes) go into file_table, groups refer to them by index
+    void addDuplicatePaths(const QStringList& paths, const QByteArray& hash, QVector<FileIndexes>& groups);
+    void showDuplicatePathGroups(const QVector<FileIndexes>& groups);
+
     void addEnumeratedFile(const QString& file, MultiFile& files);
+    void addEnumeratedFiles(const QString& dir, const QFileInfoList& files, FileTable& table);
+    // hard link sets are listed in the log, they aren't duplicates
+    void reportHardLinks(const QVector<QStringList>& link_sets);
+    // offline files of a hash catalog, returns the id of the volume it was made of (empty if it can't be read)
+    QString loadCatalog(const QString& catalog_path, MultiFile& files);
     void displayWarning(const QString &message);
 
     bool startScanAsync();
-    void hashAllFiles(QSqlDatabase db, QVector<File>& files, File::HashType hash_type, const std::function<void (File &)> &callback = [](File&){});
+
+    // reads the folders and the extension filter from the ui, the scan thread must not touch widgets
+    void collectScanInputs();
+    void resetScanState();
+    // runs startScanAsync in the thread pool, the event loop keeps running meanwhile
+    bool runScanInBackground();
+
+    // runs a scan mode without its request and display functions (they show dialogs)
+    QJsonObject daemonScan(int mode, const QJsonObject& request);
+    QJsonObject daemonWatch(const QJsonObject& request);
+    // dedupe_resuts as lists of paths of the same file
+    QJsonArray duplicateGroupsJson() const;
+    QJsonObject statsJson() const;
+
+    // runs index maintenance before a scan if the configured interval has passed
+    // (without the one-time full vacuum, that is left to the manual mode)
+    void runScheduledIndexMaintenance(QSqlDatabase db);
+    void runIndexMaintenance(QSqlDatabase db, bool allow_full_vacuum);
+    // files hashed ahead of the one being consumed, per pool thread
+    static constexpr int hash_window_per_thread = 8;
+    void hashAllFiles(FileTable& table, const QVector<quint32>& indexes, File::HashType hash_type, const std::function<void (quint32)>& callback = [](quint32){});
+    void hashAllFiles(QVector<File>& files, File::HashType hash_type, const std::function<void (File &)> &callback = [](File&){});
     void loadAllMetadataFromFiles(QSqlDatabase db, const QString& datetime_format,
                                   MultiFile &files, const std::function<bool(File&)>& callback = [](File&){return true;});
-    void loadAllThumbnailsFromFiles(QSqlDatabase db, MultiFile &files);
+    void loadAllThumbnailsFromFiles(MultiFile &files, const FileIndexes& indexes);
 
     void setUiDisabled(bool state);
 
@@ -139,6 +202,7 @@ private:
     quint64 program_start_time = 0;
     quint64 scan_start_time = 0;
     EtaMode etaMode = EtaMode::DISABLED;
+    bool scan_running = false;
     int currentMode;
     int currentSimilarity;
     FileQuantitySizeCounter total_files;
@@ -163,7 +227,13 @@ private:
     // general variables
     MultiFile indexed_files;
     MultiFile master_files;
+    // enumerated files (and hash catalog entries), compact until a mode needs File objects
+    FileTable file_table;
+    QString catalog_export_path;
     QStringList directories_to_scan;
+    QStringList whitelisted_dirs;
+    QStringList blacklisted_dirs;
+    QStringList scan_catalogs;
 
     QString masterFolder;
     QString dupesFolder;
@@ -171,11 +241,19 @@ private:
     QStringList listed_exts;
     FileUtils::ExtenstionFilterState extension_filter_state;
 
+    // scan results are written to the db in the background
+    uptr<DbWriter> db_writer;
+    // daemon watch mode, writes through db_writer
+    uptr<IndexWatcher> index_watcher;
+    QString maintenance_report;
+    // set by a mode that failed, shown instead of its (incomplete) results
+    QString scan_error;
+
     // metadata extraction
     StatsContainer stat_results;
     QVector<QString> selectedMetaFields;
     int idealThreadCount = 0;
-    QVector<ExifTool*> ex_tools;
+    uptr<ExifToolPool> ex_tool_pool;
 
     // dedupe results
     MultiFileGroupArray dedupe_resuts;
@@ -183,9 +261,5 @@ private:
 
     // exif rename format container
     ExifFormat exifRenameFormat;
-
-    // utility functions
-    template<typename T>
-    void removeDuplicates(T &arr);
 };
 #endif // MAINWINDOW_H
@@ -53,6 +53,10 @@ public:
     int     ExtractInfo(const char *file, const char *opts=nullptr);
     TagInfo *GetInfo(int cmdNum=0, double timeout=NEVER);
 
+    int     ImageTags(const char *file, const char *opts=nullptr, double timeout=NEVER);
+    int     GetTags(int cmdNum=0, double timeout=NEVER);
+    int     NextTag(TagView *tag);
+
     int     SetNewValue(const char *tag=nullptr, const char *value=nullptr, int len=-1);
     int     WriteInfo(const char *file, const char *opts=nullptr, TagInfo *info=nullptr);
 
@@ -62,6 +66,7 @@ public:
     int     IsRunning();
     int     LastComplete()  { return mLastComplete; }
     int     LastCommand()   { return mCmdNum; } // (undocumented)
+    int     GetPid()        { return mPid; }
     void    SetLastComplete(int lastComplete) { mLastComplete = lastComplete; }
     void    SetWaitTime(int waitTime) { mWaitTime = waitTime; }
 
@@ -90,6 +95,7 @@ private:
     int           mLastComplete;// result of last Complete() call
     int           mCmdNum;      // last command number
     int           mWaitTime;    // time to wait (microsec) if no commands in queue
+    char        * mTagPos;      // NextTag() position in stdout buffer (NULL if nothing to read)
 };
 
 #endif // __EXIFTOOL_H__
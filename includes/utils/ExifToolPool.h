@@ -0,0 +1,89 @@
+#ifndef EXIFTOOLPOOL_H
+#define EXIFTOOLPOOL_H
+
+#include <QMutex>
+#include <QWaitCondition>
+#include <QElapsedTimer>
+#include <QVector>
+
+#include "ExifTool.h"
+
+// elastic pool of exiftool processes
+// nothing is started until the first worker is requested, new workers are started
+// when all running ones are busy (up to max_workers) and are stopped after being idle for idle_timeout_ms
+// one supervisor process (instead of a watchdog per ExifTool) kills leftover workers if the app dies
+class ExifToolPool {
+
+public:
+    explicit ExifToolPool(int max_workers, int idle_timeout_ms = 60000);
+    ~ExifToolPool();
+
+    ExifToolPool(const ExifToolPool&) = delete;
+    ExifToolPool& operator=(const ExifToolPool&) = delete;
+
+    // get a free worker, blocks if all workers are busy and the pool can't grow anymore
+    ExifTool* acquire();
+    void release(ExifTool* ex_tool);
+
+    // stop workers that have been idle for longer than idle_timeout_ms
+    void shrinkIdle();
+
+    int maxWorkers() const { return max_workers; }
+    int runningWorkers();
+
+    // acquires a worker on first use and returns it to the pool when going out of scope
+    class Lease {
+
+    public:
+        explicit Lease(ExifToolPool* pool) : pool(pool) {}
+        ~Lease() {
+            if(ex_tool) {
+                pool->release(ex_tool);
+            }
+        }
+
+        Lease(const Lease&) = delete;
+        Lease& operator=(const Lease&) = delete;
+
+        ExifTool* get() {
+            if(!ex_tool) {
+                ex_tool = pool->acquire();
+            }
+            return ex_tool;
+        }
+
+    private:
+        ExifToolPool* pool;
+        ExifTool* ex_tool = nullptr;
+    };
+
+private:
+
+    struct IdleWorker {
+        ExifTool* ex_tool;
+        qint64 idle_since;
+    };
+
+    QMutex mutex;
+    QWaitCondition worker_released;
+
+    QVector<IdleWorker> idle_workers;
+    // idle + busy workers
+    int running_workers = 0;
+    int max_workers;
+    int idle_timeout_ms;
+
+    QElapsedTimer clock;
+
+    // write end of the pipe to the supervisor process
+    int supervisor_pipe = -1;
+    int supervisor_pid = -1;
+
+    void startSupervisor();
+    void stopWorker(ExifTool* ex_tool);
+
+    // positive pid registers a worker with the supervisor, negative unregisters it
+    void notifySupervisor(int pid);
+};
+
+#endif // EXIFTOOLPOOL_H
@@ -32,4 +32,22 @@ struct TagInfo
     TagInfo *next;      // next TagInfo in linked list
 };
 
+// Tag information pointing directly into the exiftool response buffer
+// (filled by ExifTool::NextTag(), valid until the next command completes)
+// - all strings are null terminated, value and num may contain binary data
+struct TagView
+{
+    const char *group[3];   // family 0-2 group names
+    int     groupLen[3];    // lengths of group names
+    const char *name;       // tag name
+    int     nameLen;        // length of tag name
+    const char *desc;       // tag description
+    const char *id;         // tag ID
+    const char *value;      // converted value
+    int     valueLen;       // length of value in bytes (not including null terminator)
+    const char *num;        // "numerical" value
+    int     numLen;         // length of numerical value
+    int     copyNum;        // copy number for this tag name
+};
+
 #endif // __TAGINFO_H__
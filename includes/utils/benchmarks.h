@@ -0,0 +1,14 @@
+#ifndef BENCHMARKS_H
+#define BENCHMARKS_H
+
+#include <QString>
+
+// command line benchmarks (disk_deduper --benchmark <name>), results are printed to stdout
+namespace Benchmarks {
+
+    // returns the process exit code
+    int run(const QString& name);
+
+};
+
+#endif // BENCHMARKS_H
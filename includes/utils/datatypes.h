@@ -15,6 +15,7 @@
 #include <QDataStream>
 
 #include <QFuture>
+#include <QAtomicInteger>
 
 #include <QButtonGroup>
 
@@ -26,6 +27,7 @@
 #include "ExifTool.h"
 
 #include <shared_mutex>
+#include <array>
 
 template<typename T>
 using ptr = std::shared_ptr<T>;
@@ -46,12 +48,16 @@ typedef ptr<ButtonGroups> pButtonGroups;
 typedef QVector<pButtonGroups> ButtonGroupsPerTab;
 
 struct File;
+class DbWriter;
 
 // stores a list of files
 typedef QVector<File> MultiFile;
 
-// stores a list of multiFiles
-typedef QVector<MultiFile> MultiFileGroup;
+// indexes of files in one MultiFile (the files of a scan), so groups don't copy File objects
+typedef QVector<quint32> FileIndexes;
+
+// stores a list of file index lists
+typedef QVector<FileIndexes> MultiFileGroup;
 
 // stores a list MultiFileGroups
 typedef QVector<MultiFileGroup> MultiFileGroupArray;
@@ -120,19 +126,50 @@ struct CountableQString {
     }
 };
 
+// number of metadata fields gathered for every file (entries in metadataMap_name_to_fields)
+constexpr int meta_fields_count = 11;
+
+// metadata values of a file, slots are in the same order as getMetaFieldsList()
+typedef std::array<QString, meta_fields_count> MetaFieldValues;
+
+// lookups of cached data in index.db since the app was started
+struct CacheHitCounter {
+    QAtomicInteger<quint64> hits = 0;
+    QAtomicInteger<quint64> misses = 0;
+
+    void count(bool hit) {
+        (hit ? hits : misses).fetchAndAddRelaxed(1);
+    }
+
+    double hitRatio() const {
+        quint64 total = hits.loadRelaxed() + misses.loadRelaxed();
+        return total ? hits.loadRelaxed() / (double)total : 0;
+    }
+};
+
 QList<QString> getMetaFieldsList();
+// slot of the field in MetaFieldValues, -1 if unknown
+int getMetaFieldIndex(const QString& field);
 
 struct File {
     bool valid = true;
     QString path_without_name;
     QString name;
     qint64 size_bytes;
+    qint64 mtime_ms = 0;
+    quint64 inode = 0;
+    // st_dev, together with inode identifies the file behind hard links and bind mounts
+    quint64 device = 0;
     QString extension;
     QByteArray hash = "";
     QByteArray partial_hash = "";
     QByteArray perceptual_hash;
     QPixmap thumbnail;
-    QMap<QString, QString> metadata;
+    MetaFieldValues metadata;
+    // only known from a hash catalog, the content is not available
+    bool offline = false;
+    // id of path_without_name in the FileTable the file was made from, -1 if it wasn't
+    int dir_id = -1;
 
     enum HashType {
         FULL,
@@ -146,24 +183,40 @@ struct File {
         updateMetadata(full_path);
     }
 
+    // file with known attributes, nothing is read from disk
+    File (const QString& full_path, qint64 size_bytes, qint64 mtime_ms);
+    File (const QString& dir, const QString& name, qint64 size_bytes, qint64 mtime_ms);
+
     void updateMetadata(const QFile& qfile);
 
-    QString remapMetaValue(const QString& field, const QString& value);
+    static QString remapMetaValue(int field, const QString& value);
 
     bool rename(const QString& new_name);
     bool renameWithoutExtension(const QString& new_name);
 
     static void loadStatisMetaMaps();
 
+    static CacheHitCounter hash_cache;
+    static CacheHitCounter metadata_cache;
+    static CacheHitCounter thumbnail_cache;
+
     bool loadMetadataFromDb(QSqlDatabase db);
     void loadMetadataFromExifTool(ExifTool* ex_tool, const QString& datetime_format);
-    QFuture<void> loadHash(QSqlDatabase db, HashType hash_type);
-    QFuture<void> loadThumbnail(QSqlDatabase db);
+    // read metadata without exiftool, returns false if the file format is not supported natively
+    bool loadMetadataNative(const QString& datetime_format);
+    // cached data is looked up from the worker thread, the result is true if it had to be computed (and should be saved)
+    QFuture<bool> loadHash(HashType hash_type);
+    // same as loadHash, in the calling thread
+    bool loadHashBlocking(HashType hash_type);
+    QFuture<bool> loadThumbnail();
     void postLoadThumbnail();
 
-    void saveHashToDb(QSqlDatabase db);
-    void saveMetadataToDb(QSqlDatabase db);
-    void saveThumbnailToDb(QSqlDatabase db);
+    // results are queued, the writer stores them in the background
+    void saveHashToDb(DbWriter* db_writer);
+    void saveMetadataToDb(DbWriter* db_writer);
+    void saveThumbnailToDb(DbWriter* db_writer);
+    // the file was deleted, its index entry goes away with everything cached for it
+    void removeFromDb(DbWriter* db_writer);
 
     bool operator==(const File &other) const {
         return full_path == other.full_path;
@@ -178,8 +231,11 @@ struct File {
 private:
     QString full_path;
 
+    bool selectCachedData(QSqlQuery& query, const QString& table, const QString& columns);
     bool loadHashFromDb(QSqlDatabase db, HashType hash_type);
     bool loadThumbnailFromDb(QSqlDatabase db);
+
+    void applyGatheredMetadata(const MetaFieldValues& gathered_values, const QString& datetime_format);
 };
 
 struct FileQuantitySizeCounter {
@@ -233,6 +289,21 @@ public:
           return *this;
     }
 
+    FileQuantitySizeCounter& add(qint64 size_bytes) {
+          std::unique_lock lock(mutex); // write lock
+          v_quantity ++;
+          v_size += size_bytes;
+          return *this;
+    }
+
+    // files counted somewhere else (e.g. by shard workers)
+    FileQuantitySizeCounter& add(qint32 quantity, quint64 size_bytes) {
+          std::unique_lock lock(mutex); // write lock
+          v_quantity += quantity;
+          v_size += size_bytes;
+          return *this;
+    }
+
     FileQuantitySizeCounter& operator+=(const QFile& file) {
           std::unique_lock lock(mutex); // write lock
           v_quantity ++;
@@ -255,7 +326,7 @@ struct ExifFormat {
 
     QString format_string;
     QString datetime_format;
-    QVector<QString> metaFieldKeys;
+    QVector<int> metaFieldIndexes;
     OnFailAction onFailAction;
     OnFileExistsAction onFileExistsAction;
     bool valid = true;
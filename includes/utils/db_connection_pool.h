@@ -0,0 +1,22 @@
+#ifndef DB_CONNECTION_POOL_H
+#define DB_CONNECTION_POOL_H
+
+#include <QSqlDatabase>
+
+// connections to index.db, one per thread (a QSqlDatabase can only be used from the thread that opened it)
+// a thread gets its connection on first use, reuses it for every later call and it's removed when the thread exits,
+// so pool threads doing cache lookups in parallel don't pile up named connections
+//
+// readers are read-only, results are written by DbWriter (the only connection writing the index)
+namespace DbConnectionPool {
+
+    // read-only connection of the calling thread, for cache lookups
+    QSqlDatabase reader();
+    // connection of the calling thread for the scan itself (temp tables, index maintenance)
+    QSqlDatabase connection();
+
+    int openConnections();
+
+};
+
+#endif // DB_CONNECTION_POOL_H
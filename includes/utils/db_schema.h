@@ -0,0 +1,23 @@
+#ifndef DB_SCHEMA_H
+#define DB_SCHEMA_H
+
+#include <QSqlDatabase>
+
+// layout of index.db, the version is kept in PRAGMA user_version
+//
+// version 0: metadata, hashes and thumbnails keyed by full_path TEXT (each with its own size)
+// version 1: directories (id, path) and files (id, dir_id, name, size, mtime, inode),
+//            metadata, hashes and thumbnails keyed by files.id
+//            a file's cached data is valid while its size and mtime match (mtime is NULL for migrated rows)
+// version 2: scan_progress, a single row describing the running (or interrupted) scan
+// version 3: scan_progress dropped again, an interrupted scan's results are reused as cache hits without it
+namespace DbSchema {
+
+    const int current_version = 3;
+
+    // creates missing tables and migrates older layouts, returns false if the db can't be used
+    bool init(QSqlDatabase db);
+
+};
+
+#endif // DB_SCHEMA_H
@@ -0,0 +1,129 @@
+#ifndef DB_WRITER_H
+#define DB_WRITER_H
+
+#include <QThread>
+#include <QMutex>
+#include <QWaitCondition>
+#include <QSqlDatabase>
+#include <QSqlQuery>
+#include <QHash>
+
+#include <atomic>
+
+#include "datatypes.h"
+#include "gutils.h"
+
+// writes scan results to index.db (or another index file, see db_path) from its own thread and connection
+// records are handed over through a lock-free queue (any number of producers, one consumer)
+// and written in batches, one transaction per batch, using statements prepared once
+class DbWriter {
+
+public:
+
+    struct Record {
+        enum Type {
+            HASH,
+            METADATA,
+            THUMBNAIL,
+            // files row of a deleted file (only dir and name are used)
+            REMOVE
+        };
+
+        Type type;
+        // files row
+        QString dir;
+        // FileTable directory id of dir (-1 if unknown), saves the path lookup
+        int dir_id = -1;
+        QString name;
+        qint64 size_bytes;
+        qint64 mtime_ms;
+        quint64 inode;
+
+        // HASH
+        QByteArray hash;
+        QByteArray partial_hash;
+        QByteArray perceptual_hash;
+        // METADATA
+        MetaFieldValues metadata;
+        // THUMBNAIL (png)
+        QByteArray thumbnail;
+
+        std::atomic<Record*> next {nullptr};
+    };
+
+    // an empty db_path writes to index.db, other files get the index schema first (and config)
+    explicit DbWriter(const QString& db_path = QString(), int batch_size = 512, const DbUtils::StorageConfig& config = {});
+    ~DbWriter();
+
+    DbWriter(const DbWriter&) = delete;
+    DbWriter& operator=(const DbWriter&) = delete;
+
+    // takes ownership of the record, never blocks
+    void push(Record* record);
+
+    // blocks until everything pushed so far is committed
+    void flush();
+
+    // call after removing directories from the db with another connection
+    // and when FileTable directory ids start over (a new scan)
+    void invalidateDirCache() { dir_ids_stale = true; }
+
+private:
+
+    // intrusive mpsc queue (Vyukov), producers only swap head, the writer owns tail
+    std::atomic<Record*> head;
+    Record* tail;
+    Record stub;
+
+    void enqueue(Record* record);
+    Record* pop();
+    bool queueEmpty();
+
+    std::atomic<quint64> pushed_records {0};
+    std::atomic<quint64> written_records {0};
+    std::atomic<bool> writer_idle {false};
+    std::atomic<bool> stopping {false};
+    std::atomic<bool> dir_ids_stale {false};
+
+    // only used to sleep/wake the writer and flushing threads
+    QMutex mutex;
+    QWaitCondition records_available;
+    QWaitCondition batch_written;
+
+    QString db_path;
+    int batch_size;
+    DbUtils::StorageConfig config;
+    uptr<QThread> thread;
+
+    // statements prepared once on the writer connection
+    struct Queries {
+        QSqlQuery select_dir;
+        QSqlQuery insert_dir;
+        QSqlQuery select_file;
+        QSqlQuery insert_file;
+        QSqlQuery update_file;
+        QSqlQuery invalidate_hash;
+        QSqlQuery invalidate_metadata;
+        QSqlQuery invalidate_thumbnail;
+        QSqlQuery remove_file;
+        QSqlQuery hash;
+        QSqlQuery metadata;
+        QSqlQuery thumbnail;
+    };
+
+    // directory path -> directories.id, directories are never removed while the writer runs
+    QHash<QString, qint64> dir_ids;
+    // FileTable directory id -> directories.id (0 if not known yet)
+    QVector<qint64> table_dir_ids;
+
+    qint64 dirId(Queries& queries, const Record& record);
+    void clearDirCache();
+
+    void run();
+    bool prepareQueries(QSqlDatabase db, Queries& queries);
+    // id of the files row of the record, created or updated if needed, -1 on error
+    qint64 fileId(Queries& queries, const Record& record);
+    void write(Queries& queries, const Record& record);
+};
+
+#endif // DB_WRITER_H
@@ -0,0 +1,111 @@
+#ifndef EXTERNAL_SORTER_H
+#define EXTERNAL_SORTER_H
+
+#include <QFile>
+#include <QDataStream>
+#include <QTemporaryDir>
+#include <QByteArray>
+#include <QString>
+#include <QVector>
+
+#include "datatypes.h"
+
+#include <vector>
+
+// sorts (fixed size key, path) records that may not fit in memory
+// records are buffered until memory_budget_bytes, then sorted and spilled to a run file,
+// finish() merges the runs (several passes if there are too many to open at once) into one sorted stream
+// keys are compared bytewise, so numbers should be stored big endian (see sizeKey)
+//
+// run file format (QDataStream, default version), the same on every machine:
+//     record*                   sorted by key
+//     record: key (key_size raw bytes), path (QString)
+class ExternalSorter {
+
+public:
+    ExternalSorter(const QString& temp_dir, int key_size, qint64 memory_budget_bytes);
+
+    ExternalSorter(const ExternalSorter&) = delete;
+    ExternalSorter& operator=(const ExternalSorter&) = delete;
+
+    // false if a run could not be written
+    bool add(const QByteArray& key, const QString& path);
+    // merges an already sorted run file (written by writeTo, possibly by another process) with the added records
+    // the file is not removed
+    void addRun(const QString& run_path);
+
+    // call after the last add, before reading, false if a run could not be written or read
+    bool finish();
+    // instead of finish(), writes all records to one sorted run file
+    bool writeTo(const QString& run_path);
+
+    // next record in key order, false at the end or on a read error (see hasError)
+    bool next(QByteArray& key, QString& path);
+    // next record whose key occurs at least twice, records with the same key come one after another
+    bool nextDuplicate(QByteArray& key, QString& path);
+    // a run turned out truncated or unreadable while merging, the records read so far are incomplete
+    bool hasError() const { return read_failed; }
+
+    qint64 recordCount() const { return record_count; }
+    // run files written (merge passes included), 0 if everything fit in memory
+    int spilledRuns() const { return spilled_runs; }
+
+    static QByteArray sizeKey(qint64 size_bytes);
+    static bool writeRecord(QDataStream& stream, const QByteArray& key, const QString& path);
+
+private:
+    struct Record {
+        QByteArray key;
+        QString path;
+    };
+
+    // sequential reader of a run file, key / path hold the current record
+    struct RunReader {
+        QFile file;
+        QDataStream stream;
+        QByteArray key;
+        QString path;
+        // set if read stopped before the end of the file
+        bool failed = false;
+        // false at the end of the file or on an error
+        bool read(int key_size);
+    };
+
+    // files are opened at once when merging
+    static const int max_merge_fan_in = 64;
+
+    QTemporaryDir dir;
+    int key_size;
+    qint64 memory_budget_bytes;
+
+    QVector<Record> buffer;
+    qint64 buffer_bytes = 0;
+    QStringList run_paths;
+    int spilled_runs = 0;
+    qint64 record_count = 0;
+    bool read_failed = false;
+
+    // final merge, readers form a min heap on key
+    std::vector<uptr<RunReader>> readers;
+    // position in buffer if nothing was spilled
+    int buffer_pos = 0;
+
+    // one record is read ahead, so nextDuplicate can look at the following key
+    bool has_next = false;
+    QByteArray next_key;
+    QString next_path;
+    bool has_previous = false;
+    QByteArray previous_key;
+
+    bool spill();
+    // record after the read-ahead one, from the buffer or the merged runs
+    bool readNext(QByteArray& key, QString& path);
+    bool openReaders(const QStringList& paths);
+    bool mergeRuns(const QStringList& inputs, const QString& output);
+    // merge passes until all runs can be open at once
+    bool reduceRuns();
+    QString newRunPath();
+    bool ownsRun(const QString& run_path) const;
+};
+
+#endif // EXTERNAL_SORTER_H
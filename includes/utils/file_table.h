@@ -0,0 +1,102 @@
+#ifndef FILE_TABLE_H
+#define FILE_TABLE_H
+
+#include <QHash>
+#include <QVector>
+#include <QString>
+#include <QStringView>
+#include <QFileInfo>
+
+#include "datatypes.h"
+
+#include <array>
+
+// sha256 digest stored inline (no heap block per hash)
+constexpr int digest_size = 32;
+typedef std::array<quint8, digest_size> Digest;
+
+// compact storage for enumerated files, one column per attribute (struct of arrays)
+// directories are interned, names live in one string pool and hashes in fixed width slots,
+// so a file costs ~100 bytes + its name instead of a File with its strings, hashes, pixmap and metadata
+// File objects are only made (file()) for the files a mode actually works with
+class FileTable {
+
+public:
+    int size() const { return size_col.size(); }
+    bool isEmpty() const { return size_col.isEmpty(); }
+    void clear();
+    void reserve(int files);
+
+    // returns the index of the added file
+    quint32 append(const File& file);
+    // enumerated file in an already interned directory, no File or path strings are made
+    quint32 append(quint32 dir_id, const QFileInfo& info);
+
+    // id of the directory path, every path is stored once
+    quint32 internDir(const QString& path);
+
+    quint32 dirId(quint32 index) const { return dir_col[index]; }
+    QString dirPath(quint32 index) const { return dir_paths[dir_col[index]]; }
+    QString name(quint32 index) const;
+    QString fullPath(quint32 index) const;
+    qint64 sizeBytes(quint32 index) const { return size_col[index]; }
+    qint64 mtimeMs(quint32 index) const { return mtime_col[index]; }
+    bool isOffline(quint32 index) const { return flags_col[index] & OFFLINE; }
+
+    bool hasHash(quint32 index) const { return flags_col[index] & HAS_HASH; }
+    bool hasPartialHash(quint32 index) const { return flags_col[index] & HAS_PARTIAL_HASH; }
+    const Digest& hash(quint32 index) const { return hash_col[index]; }
+    const Digest& partialHash(quint32 index) const { return partial_hash_col[index]; }
+
+    // File with everything the table knows (paths, size, hashes), nothing is read from disk
+    File file(quint32 index) const;
+    // stores the hashes gathered in a File made by file()
+    void update(quint32 index, const File& file);
+
+    // 0 .. size() - 1
+    QVector<quint32> indexes() const;
+    // all files that can be read (offline catalog entries are left out)
+    MultiFile files() const;
+
+    // drops repeated paths (overlapping scan folders, catalog entries of scanned files, the online row is kept),
+    // files end up sorted by directory and name
+    void removeDuplicatePaths();
+    // keeps one path per (device, inode), so hard links, bind mounts and differently spelled roots are hashed once
+    // returns the paths that turned out to be the same file, the kept path first
+    QVector<QStringList> removeHardLinks();
+
+    // copies a hash into a digest slot, false if it isn't a digest (empty for files that couldn't be read)
+    static bool storeDigest(Digest& slot, const QByteArray& digest);
+
+private:
+    enum Flags : quint8 {
+        HAS_HASH = 1,
+        HAS_PARTIAL_HASH = 2,
+        OFFLINE = 4
+    };
+
+    QVector<QString> dir_paths;
+    QHash<QString, quint32> dir_ids;
+    QString name_pool;
+
+    QVector<quint32> dir_col;
+    QVector<quint32> name_offset_col;
+    QVector<quint16> name_len_col;
+    QVector<qint64> size_col;
+    QVector<qint64> mtime_col;
+    QVector<quint64> inode_col;
+    QVector<quint64> device_col;
+    QVector<Digest> hash_col;
+    QVector<Digest> partial_hash_col;
+    QVector<quint8> flags_col;
+
+    QStringView nameView(quint32 index) const {
+        return QStringView(name_pool.constData() + name_offset_col[index], name_len_col[index]);
+    }
+
+    quint32 appendRow(quint32 dir_id, const QString& name, qint64 size_bytes, qint64 mtime_ms, quint64 inode, quint64 device, quint8 flags);
+    // keeps only the given rows, in that order
+    void keepRows(const QVector<quint32>& rows);
+};
+
+#endif // FILE_TABLE_H
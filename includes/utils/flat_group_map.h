@@ -0,0 +1,112 @@
+#ifndef FLAT_GROUP_MAP_H
+#define FLAT_GROUP_MAP_H
+
+#include <QVector>
+#include <QHash>
+
+#include <array>
+#include <cstring>
+
+// hash of a grouping key, qHash unless the key type has a cheaper one
+template<typename Key>
+struct FlatKeyHash {
+    uint operator()(const Key& key) const { return qHash(key); }
+};
+
+// digests are uniformly distributed already, their first bytes are a good hash
+template<std::size_t N>
+struct FlatKeyHash<std::array<quint8, N>> {
+    static_assert(N >= sizeof(quint64), "digest is too short to be used as its own hash");
+    uint operator()(const std::array<quint8, N>& key) const {
+        quint64 hash;
+        std::memcpy(&hash, key.data(), sizeof(hash));
+        return uint(hash ^ (hash >> 32));
+    }
+};
+
+// open addressing (linear probing) hash map for grouping files by a key
+// keys and values are kept in insertion order in two flat arrays, the probe table only holds
+// positions into them, so fixed size keys (digests) are stored inline and compared in place,
+// nothing is allocated per entry and iteration order doesn't depend on the hashes
+template<typename Key, typename Value, typename Hash = FlatKeyHash<Key>>
+class FlatGroupMap {
+
+public:
+    explicit FlatGroupMap(int expected_size = 0) {
+        reserve(expected_size);
+    }
+
+    int size() const { return keys.size(); }
+    bool isEmpty() const { return keys.isEmpty(); }
+
+    void reserve(int expected_size) {
+        keys.reserve(expected_size);
+        values.reserve(expected_size);
+        int capacity = 16;
+        while(capacity * max_load_percent / 100 < expected_size) {
+            capacity *= 2;
+        }
+        if(capacity > slots.size()) {
+            rehash(capacity);
+        }
+    }
+
+    // value for key, a default constructed one is inserted if the key is new
+    Value& operator[](const Key& key) {
+        int& slot = findSlot(key);
+        if(slot == empty_slot) {
+            slot = keys.size();
+            keys.append(key);
+            values.append(Value());
+            if(keys.size() * 100 > slots.size() * max_load_percent) {
+                rehash(slots.size() * 2);
+            }
+            return values.last();
+        }
+        return values[slot];
+    }
+
+    // nullptr if the key is not in the map
+    Value* find(const Key& key) {
+        int slot = findSlot(key);
+        return slot == empty_slot ? nullptr : &values[slot];
+    }
+
+    // entries in insertion order
+    const Key& keyAt(int i) const { return keys[i]; }
+    Value& valueAt(int i) { return values[i]; }
+    const QVector<Key>& allKeys() const { return keys; }
+    const QVector<Value>& allValues() const { return values; }
+
+private:
+    static constexpr int empty_slot = -1;
+    static constexpr int max_load_percent = 70;
+
+    QVector<Key> keys;
+    QVector<Value> values;
+    // positions into keys / values, the size is a power of two
+    QVector<int> slots;
+
+    int& findSlot(const Key& key) {
+        int mask = slots.size() - 1;
+        int i = Hash()(key) & mask;
+        while(slots[i] != empty_slot && !(keys[slots[i]] == key)) {
+            i = (i + 1) & mask;
+        }
+        return slots[i];
+    }
+
+    void rehash(int capacity) {
+        slots.fill(empty_slot, capacity);
+        int mask = capacity - 1;
+        for(int entry = 0; entry < keys.size(); entry++) {
+            int i = Hash()(keys[entry]) & mask;
+            while(slots[i] != empty_slot) {
+                i = (i + 1) & mask;
+            }
+            slots[i] = entry;
+        }
+    }
+};
+
+#endif // FLAT_GROUP_MAP_H
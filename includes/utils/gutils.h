@@ -45,6 +45,10 @@ namespace FileUtils {
 
     void walkDir(const QString& dir, const QStringList& blacklisted_dirs, const QStringList& extensions,
                  ExtenstionFilterState extFilterState, std::function<void(const QString&)> callback);
+    // same walk, the files of a directory are reported together (with their already stat'ed QFileInfo)
+    void walkDirByDirectory(const QString& dir, const QStringList& blacklisted_dirs, const QStringList& extensions,
+                            ExtenstionFilterState extFilterState, std::function<void(const QString& dir, const QFileInfoList& files)> callback);
+    bool passesExtensionFilter(const QString& file_name, const QStringList& extensions, ExtenstionFilterState extFilterState);
 
     PairList<File, QString> queueFilesToModify(QVector<File> &files_to_delete,
                                                const QString& target_dir, const QString& postfix);
@@ -68,7 +72,8 @@ namespace FileUtils {
     QString bytesToReadable(quint64 kb);
     quint64 readableToBytes(const QString &str);
 
-    QByteArray getFileGroupFingerprint(const QVector<File>& group);
+    // files have to come from one FileTable (their dir_id is used)
+    QByteArray getFileGroupFingerprint(const MultiFile& files, const FileIndexes& group);
 
     QPixmap generateThumbnail(const File& file, int size);
 
@@ -106,9 +111,25 @@ QT_END_NAMESPACE
 QT_BEGIN_NAMESPACE
 
 namespace DbUtils{
+
+    // sqlite settings, applied to every connection when it's opened
+    struct StorageConfig {
+        // write-ahead log, readers (browsing results) don't block the writer and vice versa
+        bool wal = true;
+        // with wal only checkpoints are synced, a crash can lose the last commits but doesn't corrupt the db
+        bool synchronous_normal = true;
+        qint64 cache_size_kib = 64 * 1024;
+        qint64 mmap_size_bytes = 256 * 1024 * 1024;
+        bool temp_store_memory = true;
+    };
+
     bool execQuery(QSqlQuery query);
     bool execQuery(QSqlDatabase db, const QString &query_str);
+    QString indexDbPath();
+    // connection to index.db for the current thread (owned by DbConnectionPool, don't close it)
     QSqlDatabase openDbConnection();
+    QSqlDatabase openDbConnection(const QString& connection_name, const QString& db_path, const StorageConfig& config = {});
+    void applyStorageConfig(QSqlDatabase db, const StorageConfig& config);
 };
 
 QT_END_NAMESPACE
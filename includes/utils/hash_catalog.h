@@ -0,0 +1,97 @@
+#ifndef HASH_CATALOG_H
+#define HASH_CATALOG_H
+
+#include <QFile>
+#include <QDir>
+#include <QString>
+
+#include "datatypes.h"
+
+// portable list of hashed files of one folder (usually a removable drive), stored in a .ddcat file
+// a catalog can be used instead of the folder itself while the drive is not mounted,
+// its files are "offline": they are compared by the stored hashes and never read
+//
+// layout (little endian), the file is memory mapped and read in place:
+//     Header
+//     Entry[entry_count]        sorted by relative path
+//     string pool               UTF-8, root path and volume id first, then the relative paths
+class HashCatalog {
+
+public:
+    static const QString file_extension;
+
+    // sha256 digests, see FileUtils::getFileHash
+    static const int digest_size = 32;
+
+    struct Header {
+        char magic[8];
+        quint32 version;
+        quint32 entry_count;
+        quint64 entries_offset;
+        quint64 strings_offset;
+        quint64 strings_size;
+        quint32 root_offset;
+        quint32 root_len;
+        quint32 volume_offset;
+        quint32 volume_len;
+        qint64 created_ms;
+    };
+
+    struct Entry {
+        qint64 size_bytes;
+        qint64 mtime_ms;
+        quint8 hash[digest_size];
+        quint8 partial_hash[digest_size];
+        quint32 path_offset;
+        quint32 path_len;
+        quint32 flags;
+        quint32 reserved;
+
+        enum Flags {
+            HAS_HASH = 1,
+            HAS_PARTIAL_HASH = 2
+        };
+    };
+
+    HashCatalog() {}
+    ~HashCatalog();
+
+    HashCatalog(const HashCatalog&) = delete;
+    HashCatalog& operator=(const HashCatalog&) = delete;
+
+    static bool isCatalogPath(const QString& path);
+
+    // writes the hashes of files (they have to be under root), files without any hash are skipped
+    static bool write(const QString& catalog_path, const QString& root, const MultiFile& files);
+
+    // label and filesystem uuid of the volume the path is on
+    static QString volumeId(const QString& path);
+
+    bool open(const QString& catalog_path);
+    void close();
+
+    int size() const { return header ? header->entry_count : 0; }
+    QString root() const { return root_path; }
+    QString volume() const;
+
+    const Entry& entry(int index) const { return entries[index]; }
+    QString relativePath(int index) const;
+    // offline file with the stored hashes, the path is where the file was when the catalog was written
+    File file(int index) const;
+
+private:
+    QFile catalog_file;
+    const uchar* data = nullptr;
+    qint64 data_size = 0;
+
+    const Header* header = nullptr;
+    const Entry* entries = nullptr;
+    const char* strings = nullptr;
+    // decoded once in open, every file() needs it
+    QString root_path;
+    QDir root_dir;
+
+    QString string(quint32 offset, quint32 len) const;
+};
+
+#endif // HASH_CATALOG_H
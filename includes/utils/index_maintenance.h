@@ -0,0 +1,37 @@
+#ifndef INDEX_MAINTENANCE_H
+#define INDEX_MAINTENANCE_H
+
+#include <QSqlDatabase>
+#include <QString>
+#include <QVector>
+#include <QPair>
+
+#include <functional>
+
+// keeps index.db from growing forever: entries of deleted, moved or modified files are pruned
+// (files on a drive that isn't mounted are kept),
+// freed pages are returned to the filesystem and the space used per table is reported
+namespace IndexMaintenance {
+
+    struct Report {
+        qint64 checked_files = 0;
+        qint64 missing_files = 0;
+        qint64 changed_files = 0;
+        qint64 offline_files = 0;
+        qint64 removed_directories = 0;
+        qint64 db_size_before = 0;
+        qint64 db_size_after = 0;
+        // table name -> bytes (or rows if sqlite has no dbstat)
+        QVector<QPair<QString, qint64>> table_sizes;
+        bool table_sizes_in_bytes = true;
+
+        QString toString() const;
+    };
+
+    // nothing else may write meanwhile: the db writer must be flushed before and its directory cache invalidated afterwards
+    // switching an old index to incremental vacuum rewrites it once, that only happens if allow_full_vacuum is set
+    Report run(QSqlDatabase db, const std::function<void(const QString&)>& status_callback, bool allow_full_vacuum);
+
+};
+
+#endif // INDEX_MAINTENANCE_H
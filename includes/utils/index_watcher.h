@@ -0,0 +1,94 @@
+#ifndef INDEX_WATCHER_H
+#define INDEX_WATCHER_H
+
+#include <QSocketNotifier>
+#include <QFutureWatcher>
+#include <QTimer>
+#include <QElapsedTimer>
+#include <QHash>
+#include <QSet>
+#include <QStringList>
+
+#include "datatypes.h"
+#include "gutils.h"
+
+// keeps index.db current while files change, instead of rescanning the folders (linux, inotify)
+// every directory under the roots is watched, written, moved and deleted files are queued
+// and after a quiet period hashed (partial and full) and their native metadata read on the thread pool,
+// the results go through the usual File::saveHashToDb / saveMetadataToDb path
+// if the kernel's event queue overflows, events are lost and the watched folders are walked again,
+// files that didn't change are cache hits in the index
+class IndexWatcher : public QObject {
+    Q_OBJECT
+
+public:
+    explicit IndexWatcher(DbWriter* db_writer);
+    ~IndexWatcher();
+
+    // false if inotify is not available
+    bool start(const QStringList& roots, const QStringList& blacklisted_dirs,
+               const QStringList& extensions, FileUtils::ExtenstionFilterState filter_state);
+    void stop();
+    bool isWatching() const { return inotify_fd != -1; }
+
+    // processes the queue now and waits until the index is current
+    void flush();
+    // flushes and then only collects changes until resume, nothing is written to the index meanwhile
+    void pause();
+    void resume();
+
+    const QStringList& watchedRoots() const { return roots; }
+    int watchedDirs() const { return dir_paths.size(); }
+    int queuedFiles() const { return changed_files.size() + removed_files.size(); }
+
+private:
+    struct ChangedFile {
+        File file;
+        bool hashed = false;
+        bool metadata_read = false;
+    };
+
+    // changes are collected this long before they're processed, files are often written in several steps
+    static const int quiet_period_ms = 2000;
+    // a folder that never calms down (downloads, logs) is processed at least this often
+    static const int max_delay_ms = 30000;
+
+    DbWriter* db_writer;
+    int inotify_fd = -1;
+    uptr<QSocketNotifier> notifier;
+    QTimer quiet_timer;
+    bool paused = false;
+    // since the oldest unprocessed change
+    QElapsedTimer pending_since;
+
+    QStringList roots;
+    QStringList blacklisted_dirs;
+    QStringList extensions;
+    FileUtils::ExtenstionFilterState filter_state = FileUtils::DISABLED;
+
+    // watch descriptor -> directory
+    QHash<int, QString> dir_paths;
+
+    QSet<QString> changed_files;
+    QSet<QString> removed_files;
+
+    // batch being hashed, only touched by the thread pool until batch_watcher finishes
+    QVector<ChangedFile> batch;
+    QFutureWatcher<void> batch_watcher;
+
+    // watches dir and its subfolders, their files are queued too if they may have changed unnoticed
+    void watchTree(const QString& dir, bool queue_files);
+    void unwatchTree(const QString& dir);
+    // indexed files under a folder that left the watched tree
+    void queueIndexedRemovals(const QString& dir);
+    void rescan();
+
+    void saveBatch();
+
+private slots:
+    void readEvents();
+    void processQueue();
+    void onBatchFinished();
+};
+
+#endif // INDEX_WATCHER_H
@@ -0,0 +1,19 @@
+#ifndef NATIVE_METADATA_H
+#define NATIVE_METADATA_H
+
+#include <QString>
+#include <QMap>
+
+// in-process metadata reader for the most common containers
+// (JPEG EXIF, PNG chunks, MP4/MOV boxes), only headers are read
+// tags are returned under the same names exiftool uses, so they can go through the same field mapping
+
+namespace NativeMetadata {
+
+    // returns false if the container is not supported, could not be parsed or has metadata
+    // that is only read by exiftool (XMP, QuickTime keys), use exiftool then
+    bool readTags(const QString& full_path, QMap<QString, QString>& tags);
+
+};
+
+#endif // NATIVE_METADATA_H
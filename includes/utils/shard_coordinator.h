@@ -0,0 +1,99 @@
+#ifndef SHARD_COORDINATOR_H
+#define SHARD_COORDINATOR_H
+
+#include <QLocalServer>
+#include <QLocalSocket>
+#include <QProcess>
+#include <QTemporaryDir>
+#include <QJsonObject>
+#include <QJsonArray>
+#include <QSqlDatabase>
+#include <QStringList>
+
+#include <functional>
+#include <vector>
+
+#include "datatypes.h"
+
+// sharded hash scan: the folders are split across worker processes (disk_deduper --shard-worker),
+// each worker writes its own partial index (index.db layout) and sorted run files (ExternalSorter format),
+// the coordinator only merges runs to find the keys that repeat across all shards
+//
+// phases, every worker gets the same message and answers with "done" (or "error")
+//     enumerate: (size, path) run of all files of the shard
+//     hash:      files of the input run whose keys are in the keys file are hashed,
+//                partial hashes first (size + partial hash, path), then full ones (size + hash, path)
+// between phases the coordinator merges the runs of all workers into the next keys file
+//
+// messages are JSON objects, one per line, over a local socket
+// the workers only exchange file paths with the coordinator, so the transport can later be a tcp socket
+// to workers on other machines
+class ShardCoordinator {
+
+public:
+    struct Options {
+        QStringList roots;
+        QStringList blacklisted_dirs;
+        QStringList extensions;
+        int extension_filter_state = 0;
+        int workers = 4;
+        // shared by all workers (and the coordinator's merges)
+        qint64 memory_budget_bytes = 512 * 1024 * 1024;
+        // run files and partial indexes are written to a temporary directory in here
+        QString work_dir;
+    };
+
+    explicit ShardCoordinator(const Options& options);
+    ~ShardCoordinator();
+
+    ShardCoordinator(const ShardCoordinator&) = delete;
+    ShardCoordinator& operator=(const ShardCoordinator&) = delete;
+
+    // runs all phases, status is called with a description of the current one
+    bool run(const std::function<void(const QString& status)>& status);
+
+    // (size + hash key, paths) of every group of files with the same size and hash
+    const QVector<QPair<QByteArray, QStringList>>& duplicateGroups() const { return duplicate_groups; }
+    qint64 totalFiles() const { return total_files; }
+    qint64 totalBytes() const { return total_bytes; }
+
+    // copies the hashes of the workers' partial indexes into db (index.db), false if a shard couldn't be merged
+    bool mergePartialIndexes(QSqlDatabase db);
+
+    static bool sendMessage(QLocalSocket& socket, const QJsonObject& message);
+    // blocks until a whole message has arrived
+    static bool readMessage(QLocalSocket& socket, QJsonObject& message);
+
+private:
+    struct Worker {
+        uptr<QProcess> process;
+        QLocalSocket* socket = nullptr;
+        QString index_path;
+    };
+
+    static const int connect_timeout_ms = 30000;
+    // workers get this long to flush their partial index after quit
+    static const int stop_timeout_ms = 60000;
+
+    Options options;
+    QTemporaryDir work_dir;
+    QLocalServer server;
+    std::vector<Worker> workers;
+
+    QVector<QPair<QByteArray, QStringList>> duplicate_groups;
+    qint64 total_files = 0;
+    qint64 total_bytes = 0;
+
+    bool startWorkers();
+    void stopWorkers();
+    // folders of each shard (path, recursive), roots are split into their subfolders if there are fewer roots than workers
+    QVector<QJsonArray> shardUnits() const;
+    // sends every worker its message and waits for all of them to finish
+    bool runPhase(const QString& name, const std::function<QJsonObject(int shard)>& message,
+                  const std::function<void(const QString& status)>& status, QVector<QJsonObject>& replies);
+    // keys that occur more than once in all runs together
+    bool writeRepeatedKeys(const QStringList& runs, int key_size, const QString& keys_path);
+    QString workPath(const QString& name, int shard = -1) const;
+};
+
+#endif // SHARD_COORDINATOR_H
@@ -0,0 +1,14 @@
+#ifndef SHARD_WORKER_H
+#define SHARD_WORKER_H
+
+#include <QString>
+
+// worker process of a sharded scan (disk_deduper --shard-worker <server name> <shard>), see ShardCoordinator
+namespace ShardWorker {
+
+    // serves the coordinator until it says quit, returns the process exit code
+    int run(const QString& server_name, int shard);
+
+};
+
+#endif // SHARD_WORKER_H
@@ -0,0 +1,35 @@
+#ifndef SORT_GROUPING_H
+#define SORT_GROUPING_H
+
+#include <QVector>
+#include <QString>
+
+#include <functional>
+
+#include "datatypes.h"
+#include "file_table.h"
+
+// grouping backend that radix sorts packed (key prefix, size, file index) records and
+// takes the runs of equal records as groups, one linear pass instead of a lookup per file
+// used instead of FlatGroupMap when the "grouping_backend" setting is "radix_sort"
+namespace SortGrouping {
+
+    struct Record {
+        // first 8 bytes of the digest or a 64 bit hash of the name
+        quint64 key;
+        // 0 if the size doesn't matter (names)
+        qint64 size;
+        quint32 index;
+    };
+
+    quint64 keyOf(const Digest& digest);
+    quint64 keyOf(const QString& string);
+
+    // groups of at least 2 indexes with equal records, runs are split by same_key since records only hold a key prefix
+    // indexes in a group are ascending, groups are ordered by their first index (like FlatGroupMap iteration)
+    // records is used as scratch space
+    QVector<FileIndexes> findGroups(QVector<Record>& records, const std::function<bool (quint32, quint32)>& same_key);
+
+};
+
+#endif // SORT_GROUPING_H
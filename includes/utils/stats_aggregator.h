@@ -0,0 +1,48 @@
+#ifndef STATS_AGGREGATOR_H
+#define STATS_AGGREGATOR_H
+
+#include <QHash>
+#include <QVector>
+#include <QString>
+#include <QSqlDatabase>
+
+#include "datatypes.h"
+
+// counts files and their sizes per distinct value of the selected metadata fields
+// one hash map per field, so adding a file doesn't depend on the number of distinct values
+// partial aggregates (one per thread) are combined with merge()
+class StatsAggregator {
+
+public:
+    explicit StatsAggregator(const QVector<QString>& meta_fields = {});
+
+    void add(const File& file);
+    // add an already aggregated value (count files with total size) of the n-th selected field
+    void add(int selected_field, const QString& value, quint32 count, qint64 total_size_bytes);
+
+    void merge(const StatsAggregator& other);
+
+    // aggregates the files whose metadata is already cached, using GROUP BY queries on the metadata table
+    // files without (up to date) cached metadata are returned in uncached_files, cached ones are counted in cached_files
+    void addCachedFromDb(QSqlDatabase db, const MultiFile& files, MultiFile& uncached_files, FileQuantitySizeCounter& cached_files);
+
+    // aggregates files in parallel, every worker fills its own partial aggregate
+    static StatsAggregator aggregate(const QVector<QString>& meta_fields, const MultiFile& files, int workers);
+
+    // per field values sorted by count, with percentages relative to total_files
+    QVector<NamedCountableQStringList> results(const FileQuantitySizeCounter& total_files) const;
+
+private:
+
+    struct ValueTotals {
+        quint32 count = 0;
+        qint64 total_size_bytes = 0;
+    };
+
+    QVector<QString> meta_fields;
+    // slots of the selected fields in File::metadata
+    QVector<int> meta_field_indexes;
+    QVector<QHash<QString, ValueTotals>> fields_stats;
+};
+
+#endif // STATS_AGGREGATOR_H
@@ -1,8 +1,13 @@
 #include "mainwindow.h"
+#include "benchmarks.h"
+#include "shard_worker.h"
+#include "index_daemon.h"
 
 #include <QtGlobal>
 #include <QApplication>
 
+#include <cstring>
+
 void captureMessageOutput(QtMsgType type, const QMessageLogContext &context, const QString &msg) {
 
     QString msg_wrap;
@@ -39,6 +44,25 @@ void captureMessageOutput(QtMsgType type, const QMessageLogContext &context, con
 
 int main(int argc, char *argv[]) {
 
+    // disk_deduper --shard-worker <server name> <shard>, started by ShardCoordinator
+    // no windows (File still needs a gui application for its pixmap), messages go to stderr (forwarded by the coordinator)
+    for(int i = 1; i + 2 < argc; i++) {
+        if(strcmp(argv[i], "--shard-worker") == 0) {
+            qputenv("QT_QPA_PLATFORM", "offscreen");
+            QGuiApplication a(argc, argv);
+            return ShardWorker::run(QString::fromLocal8Bit(argv[i + 1]), atoi(argv[i + 2]));
+        }
+    }
+
+    // disk_deduper --daemon, the window is created but never shown, see IndexDaemon
+    bool daemon_mode = false;
+    for(int i = 1; i < argc; i++) {
+        daemon_mode = daemon_mode || strcmp(argv[i], "--daemon") == 0;
+    }
+    if(daemon_mode) {
+        qputenv("QT_QPA_PLATFORM", "offscreen");
+    }
+
     qInstallMessageHandler(captureMessageOutput);
     qRegisterMetaType<LogLevel>("LogLevel");
     qRegisterMetaTypeStreamOperators<FolderListItemData>("FolderListItemData");
@@ -48,7 +72,20 @@ int main(int argc, char *argv[]) {
     a.setApplicationName("disk_deduper_qt");
     a.setApplicationDisplayName("Disk deduper");
 
+    // disk_deduper --benchmark <name>
+    int benchmark_arg = a.arguments().indexOf("--benchmark");
+    if(benchmark_arg != -1) {
+        return Benchmarks::run(a.arguments().value(benchmark_arg + 1));
+    }
+
     MainWindow w;
+    if(daemon_mode) {
+        IndexDaemon index_daemon(&w);
+        if(!index_daemon.listen()) {
+            return 1;
+        }
+        return a.exec();
+    }
     w.show();
     return a.exec();
 }
@@ -8,8 +8,8 @@
 #include "deletion_confirmation_dialog.h"
 #include "ui_dupe_results_dialog.h"
 
-Dupe_results_dialog::Dupe_results_dialog(QWidget *parent, const MultiFileGroupArray& results, const FileQuantitySizeCounter& total_files) :
-    QDialog(parent), ui(new Ui::Dupe_results_dialog) {
+Dupe_results_dialog::Dupe_results_dialog(QWidget *parent, const MultiFile& files, const MultiFileGroupArray& results, const FileQuantitySizeCounter& total_files) :
+    QDialog(parent), files(files), ui(new Ui::Dupe_results_dialog) {
 
     ui->setupUi(this);
 
@@ -58,9 +58,10 @@ void Dupe_results_dialog::loadTab(const QString& name, const MultiFileGroup& lis
         for(auto& button_group: *button_groups) {
             QList<QAbstractButton*> buttons = button_group->buttons();
             for (auto button: buttons){
-                // get all files except selected
-                if(button != button_group->checkedButton()) {
-                    files_to_delete.append(button_to_file_map.value(button));
+                // get all files except selected, offline catalog entries can't be deleted
+                const File& file = files.at(button_to_file_map.value(button));
+                if(button != button_group->checkedButton() && !file.offline) {
+                    files_to_delete.append(file);
                 }
             }
         }
@@ -111,7 +112,7 @@ void Dupe_results_dialog::loadTab(const QString& name, const MultiFileGroup& lis
             }
         });
 
-        QLabel* path_label = new QLabel(group[0].path_without_name, scrollAreaWidgetContents);
+        QLabel* path_label = new QLabel(files.at(group[0]).path_without_name, scrollAreaWidgetContents);
         path_label->setMaximumWidth(150);
         path_label->setMinimumWidth(150);
         path_label->setWordWrap(true);
@@ -120,15 +121,16 @@ void Dupe_results_dialog::loadTab(const QString& name, const MultiFileGroup& lis
         groupContainer->addLayout(infoAndButtonContainer);
 
         int index = 0;
-        for(const auto& file: group) {
+        for(auto file_index: group) {
+            const File& file = files.at(file_index);
 
             QVBoxLayout* preview_container = new QVBoxLayout();
 
             // construct 2 labels (preview and filename)
             ClickableQLabel *preview_label = new ClickableQLabel(scrollAreaWidgetContents);
             connect(preview_label, &ClickableQLabel::clicked, preview_label,
-            [file](){
-                QDesktopServices::openUrl(QUrl(QString("file://%1").arg(file)));
+            [full_path = QString(file)](){
+                QDesktopServices::openUrl(QUrl(QString("file://%1").arg(full_path)));
             });
             preview_label->setDisabled(true);
 
@@ -143,7 +145,7 @@ void Dupe_results_dialog::loadTab(const QString& name, const MultiFileGroup& lis
 
 
             QRadioButton* selection_button = new QRadioButton("select", scrollAreaWidgetContents);
-            button_to_file_map.insert(selection_button, file);
+            button_to_file_map.insert(selection_button, file_index);
             preview_container->addWidget(selection_button);
 
             connect(selection_button, &QRadioButton::toggled, this,
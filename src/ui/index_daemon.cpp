@@ -0,0 +1,72 @@
+#include "index_daemon.h"
+#include "mainwindow.h"
+
+#include <QJsonDocument>
+#include <QPointer>
+#include <QSettings>
+#include <QDebug>
+
+IndexDaemon::IndexDaemon(MainWindow* window) : window(window) {
+    QObject::connect(&server, &QLocalServer::newConnection, &server, [this]() {
+        while(server.hasPendingConnections()) {
+            addClient(server.nextPendingConnection());
+        }
+    });
+}
+
+bool IndexDaemon::listen() {
+    QSettings settings(QSettings::UserScope, "disk_deduper_qt", "ui_state");
+    QString server_name = settings.value("daemon_socket", "disk_deduper_daemon").toString();
+
+    // two daemons would both write index.db
+    QLocalSocket running_daemon;
+    running_daemon.connectToServer(server_name);
+    if(running_daemon.waitForConnected(connect_timeout_ms)) {
+        qCritical() << "Another daemon is already listening on" << server_name;
+        return false;
+    }
+
+    // only the current user may query the index
+    server.setSocketOptions(QLocalServer::UserAccessOption);
+    // nobody answered, the socket file is left over by a daemon that crashed
+    QLocalServer::removeServer(server_name);
+    if(!server.listen(server_name)) {
+        qCritical() << "Failed starting daemon server" << server_name << ":" << server.errorString();
+        return false;
+    }
+    qInfo() << "Daemon listening on" << server.fullServerName();
+    return true;
+}
+
+void IndexDaemon::addClient(QLocalSocket* socket) {
+    QObject::connect(socket, &QLocalSocket::readyRead, &server, [this, socket]() { readRequests(socket); });
+    QObject::connect(socket, &QLocalSocket::disconnected, socket, &QObject::deleteLater);
+    QObject::connect(socket, &QObject::destroyed, &server, [this, socket]() { busy_clients.remove(socket); });
+}
+
+void IndexDaemon::readRequests(QLocalSocket* socket) {
+    // scans run a nested event loop, more lines of the same client arrive while its request is answered
+    if(busy_clients.contains(socket)) {
+        return;
+    }
+    busy_clients.insert(socket);
+
+    QPointer<QLocalSocket> client(socket);
+    while(client && client->canReadLine()) {
+        QJsonDocument request = QJsonDocument::fromJson(client->readLine());
+        QJsonObject reply;
+        if(!request.isObject()) {
+            reply = {{"ok", false}, {"error", "Invalid request, requests are JSON objects, one per line"}};
+        } else {
+            reply = window->daemonRequest(request.object());
+        }
+        // the client may have disconnected during a scan
+        if(client) {
+            client->write(QJsonDocument(reply).toJson(QJsonDocument::Compact) + "\n");
+        }
+    }
+
+    if(client) {
+        busy_clients.remove(socket);
+    }
+}
@@ -9,6 +9,12 @@
 #include "exif_rename_builder_dialog.h"
 #include "dynamic_selection_dialog.h"
 #include "move_confirmation_dialog.h"
+#include "stats_aggregator.h"
+#include "db_schema.h"
+#include "hash_catalog.h"
+#include "sort_grouping.h"
+#include "external_sorter.h"
+#include "shard_coordinator.h"
 
 #include <constants.h>
 
@@ -36,7 +42,12 @@ enum ScanMode {
     AUTO_DEDUPE_MOVE = 3,
     AUTO_DEDUPE_RENAME = 4,
     EXIF_RENAME = 5,
-    SHOW_STATS = 6
+    SHOW_STATS = 6,
+    INDEXED_HASH_COMPARE = 7,
+    INDEX_MAINTENANCE = 8,
+    EXPORT_CATALOG = 9,
+    EXTERNAL_HASH_COMPARE = 10,
+    SHARDED_HASH_COMPARE = 11
 };
 
 struct ScanModeProperties {
@@ -45,30 +56,55 @@ struct ScanModeProperties {
     std::function<QString(MainWindow*)> request_function;
     std::function<void(MainWindow*, QSqlDatabase)> process_function;
     std::function<void(MainWindow*)> display_function;
+    // modes that only work with the index don't walk the folders
+    bool enumerate_files = true;
+    // modes that work on the whole index don't need selected folders
+    bool uses_folders = true;
+    // the mode works on file_table, indexed_files is not filled
+    bool compact_files = false;
+    // paths of the same file (hard links, bind mounts) are kept once, modes working with names keep all of them
+    bool collapse_hard_links = true;
+    // hash catalogs in the folder list stand in for their folders, only modes comparing full hashes can use them
+    bool uses_catalogs = false;
 };
 
 QList<ScanModeProperties> scan_modes = {
 
     {"Hash duplicates", "Compare files by hash and show results in groups for further action",
-     nullptr, &MainWindow::hashCompare, &MainWindow::fileCompare_display},
+     nullptr, &MainWindow::hashCompare, &MainWindow::fileCompare_display, true, true, true, true, true},
 
     {"Find similar files", "Compare files by perceptual hash and show results in groups for further action",
      nullptr, &MainWindow::phashCompare, &MainWindow::fileCompare_display},
 
     {"Name duplicates", "Compare files by name and show results in groups for further action",
-     nullptr, &MainWindow::nameCompare, &MainWindow::fileCompare_display},
+     nullptr, &MainWindow::nameCompare, &MainWindow::fileCompare_display, true, true, false, false},
 
     {"Auto dedupe(move)", "Compare master folder and slave folders by hash (Files from the slave folders are moved into the dupes folder if they are present in the master folder)",
-     &MainWindow::autoDedupe_request, &MainWindow::autoDedupe_move, &MainWindow::autoDedupe_display},
+     &MainWindow::autoDedupe_request, &MainWindow::autoDedupe_move, &MainWindow::autoDedupe_display, true, true, false, false, true},
 
     {"Auto dedupe(rename)", "Compare master folder and slave folders by hash (DELETED_ is added to the name of a file from the slave folders if it is present in the master folder)",
-     &MainWindow::autoDedupe_request, &MainWindow::autoDedupe_rename, &MainWindow::autoDedupe_display},
+     &MainWindow::autoDedupe_request, &MainWindow::autoDedupe_rename, &MainWindow::autoDedupe_display, true, true, false, false, true},
 
     {"EXIF rename", "Rename files according to their EXIF data (Name format: <creation date and time>_<camera model>_numbers from file name)",
-     &MainWindow::exifRename_request, &MainWindow::exifRename, nullptr},
+     &MainWindow::exifRename_request, &MainWindow::exifRename, nullptr, true, true, false, false},
 
     {"Show statistics", "Get statistics of selected folders (Extensions, camera models) and display them",
-     &MainWindow::showStats_request, &MainWindow::showStats, &MainWindow::showStats_display}
+     &MainWindow::showStats_request, &MainWindow::showStats, &MainWindow::showStats_display},
+
+    {"Hash duplicates (from index)", "Show duplicates already known from previous hash scans of the selected folders, only the found duplicates are checked on disk (new files are not found)",
+     nullptr, &MainWindow::indexedHashCompare, &MainWindow::fileCompare_display, false},
+
+    {"Index maintenance", "Remove index entries of deleted or modified files, compact the index and show how much space it uses (also runs automatically every index_maintenance_interval_days days)",
+     nullptr, &MainWindow::indexMaintenance, &MainWindow::indexMaintenance_display, false, false},
+
+    {"Export hash catalog", "Hash the selected folder and save the hashes to a catalog, the catalog can be used in place of the folder (e.g. as a master) when its drive is not mounted",
+     &MainWindow::exportCatalog_request, &MainWindow::exportCatalog, nullptr, true, true, false, false},
+
+    {"Hash duplicates (large datasets)", "Compare files by hash without keeping all files in memory, files are sorted on disk by size and hash (memory use is limited by the external_memory_budget_mb setting, sort files go to external_sort_dir)",
+     nullptr, &MainWindow::externalHashCompare, &MainWindow::fileCompare_display, false},
+
+    {"Hash duplicates (sharded)", "Compare files by hash in shard_workers worker processes, each one scans part of the selected folders into its own partial index, the results are merged at the end (uses the same memory budget and sort folder as the large datasets mode)",
+     nullptr, &MainWindow::shardedHashCompare, &MainWindow::fileCompare_display, false}
 
 };
 
@@ -85,38 +121,27 @@ QTextStream MainWindow::currentLogFileStream;
 const LogLevel logLevel = LogLevel::INFO;
 QSettings settings(QSettings::UserScope, "disk_deduper_qt", "ui_state");
 
+// settings used by the scan thread, a QSettings object must not be shared between threads
+static QVariant scanSetting(const QString& key, const QVariant& default_value = QVariant()) {
+    return QSettings(QSettings::UserScope, "disk_deduper_qt", "ui_state").value(key, default_value);
+}
+
 MainWindow::MainWindow(QWidget *parent): QMainWindow(parent), ui(new Ui::MainWindow) {
 
     // init local sqlite database
     QSqlDatabase storage_db = DbUtils::openDbConnection();
 
     if(storage_db.isOpen()) {
-
-        QString columns;
-        QList<QString> metaFieldsList = getMetaFieldsList();
-        for(auto& meta_field: metaFieldsList) {
-            columns += "," + meta_field.replace(" ", "_") + " TEXT";
-        }
-
-        QString init_query_metadata = QString("CREATE TABLE IF NOT EXISTS metadata (full_path TEXT PRIMARY KEY, size INTEGER %1)").arg(columns);
-        QString init_query_hashes = "CREATE TABLE IF NOT EXISTS hashes (full_path TEXT PRIMARY KEY, size INTEGER, hash BLOB, partial_hash BLOB, perceptual_hash BLOB)";
-        QString init_query_thumbnails = "CREATE TABLE IF NOT EXISTS thumbnails (full_path TEXT PRIMARY KEY, size INTEGER, thumbnail BLOB)";
-
-        qInfo() << "Init db (metadata): " << init_query_metadata;
-        qInfo() << "Init db (hashes): " << init_query_hashes;
-        qInfo() << "Init db (thumbnails): " << init_query_thumbnails;
-
-        DbUtils::execQuery(storage_db, init_query_metadata);
-        DbUtils::execQuery(storage_db, init_query_hashes);
-        DbUtils::execQuery(storage_db, init_query_thumbnails);
+        DbSchema::init(storage_db);
     }
 
+    db_writer.reset(new DbWriter());
+
     ui->setupUi(this);
 
+    // exiftool workers are started on demand
     idealThreadCount = QThreadPool::globalInstance()->maxThreadCount();
-    for(int i = 0; i < idealThreadCount; i++) {
-        ex_tools.append(new ExifTool());
-    }
+    ex_tool_pool.reset(new ExifToolPool(idealThreadCount));
 
     setWindowTitle("Disk deduper");
 
@@ -135,8 +160,8 @@ MainWindow::MainWindow(QWidget *parent): QMainWindow(parent), ui(new Ui::MainWin
     setCurrentTask("Idle");
 
     QStringList modeNames;
-    for(auto& [mode_name, mode_description, pfunc, dfunc, rfunc]: scan_modes) {
-        modeNames.push_back(mode_name);
+    for(const auto& mode: scan_modes) {
+        modeNames.push_back(mode.name);
     }
     ui->mode_combo_box->insertItems(0, modeNames);
 
@@ -193,8 +218,10 @@ MainWindow::MainWindow(QWidget *parent): QMainWindow(parent), ui(new Ui::MainWin
 
     // setup ui listeners
     connect(ui->add_scan_folder_button, &QPushButton::clicked, this, &MainWindow::onAddScanFolderClicked);
+    connect(ui->add_catalog_button, &QPushButton::clicked, this, &MainWindow::onAddCatalogClicked);
 
     connect(ui->set_master_folder_button, &QPushButton::clicked, this, &MainWindow::onSetMasterFolderClicked);
+    connect(ui->set_master_catalog_button, &QPushButton::clicked, this, &MainWindow::onSetMasterCatalogClicked);
     connect(ui->set_dupes_folder_button, &QPushButton::clicked, this, &MainWindow::onSetDupesFolderClicked);
 
     connect(ui->add_extention_button, &QPushButton::clicked, this, &MainWindow::onAddExtensionButtonClicked);
@@ -229,10 +256,6 @@ MainWindow::~MainWindow() {
     settings.setValue("eta_speed", ui->speed_based_eta_checkbox->isChecked());
     settings.setValue("similarity", ui->similarity_slider->value());
 
-    for(auto& ex_tool: ex_tools) {
-        delete ex_tool;
-    }
-
     delete ui;
 }
 
@@ -319,6 +342,8 @@ void MainWindow::updateLoop2s() {
     // update memory usage
     ui->memory_usage_label->setText(QString("Memory usage: %1").arg(FileUtils::bytesToReadable(FileUtils::getMemUsedKb() * 1024)));
 
+    // stop exiftool workers that are not needed anymore
+    ex_tool_pool->shrinkIdle();
 }
 
 #pragma endregion}
@@ -337,6 +362,22 @@ void MainWindow::onSetMasterFolderClicked() {
     }
 }
 
+void MainWindow::onAddCatalogClicked() {
+    QStringList catalogs = QFileDialog::getOpenFileNames(this, "Choose hash catalogs", "",
+                                                         QString("Hash catalogs (*.%1)").arg(HashCatalog::file_extension));
+    // catalogs can't be blacklisted, there is nothing to walk
+    addItemsToList(catalogs, ui->folders_to_scan_list, false);
+}
+
+void MainWindow::onSetMasterCatalogClicked() {
+    QString temp = QFileDialog::getOpenFileName(this, "Choose master catalog", "",
+                                                QString("Hash catalogs (*.%1)").arg(HashCatalog::file_extension));
+    if(!temp.isEmpty()) {
+        masterFolder = temp;
+        ui->master_folder_label->setText(QString("Master folder: %1").arg(masterFolder));
+    }
+}
+
 void MainWindow::onSetDupesFolderClicked() {
     QString temp = FileUtils::callDirSelectionDialogue(this, "Choose dupes folder");
     if(!temp.isEmpty()) {
@@ -395,11 +436,17 @@ void MainWindow::onSimilarityChanged(int new_value) {
 }
 
 void MainWindow::onStartScanButtonClicked() {
-    if(ui->folders_to_scan_list->count() == 0) {
+    if(scan_modes.at(currentMode).uses_folders && ui->folders_to_scan_list->count() == 0) {
         displayWarning("Nothing to scan, please add folders");
         return;
     }
 
+    collectScanInputs();
+    if(!scan_catalogs.isEmpty() && !scan_modes.at(currentMode).uses_catalogs) {
+        displayWarning(QString("%1 can't use hash catalogs, please remove them from the folders to scan").arg(scan_modes.at(currentMode).name));
+        return;
+    }
+
     if(scan_modes.at(currentMode).request_function) {
         QString message = scan_modes.at(currentMode).request_function(this);
         if(!message.isEmpty()) {
@@ -408,7 +455,47 @@ void MainWindow::onStartScanButtonClicked() {
         }
     }
 
-    // reset variables
+    resetScanState();
+    setUiDisabled(true);
+
+    if(!runScanInBackground()) {
+        displayWarning("Nothing to scan, your filters filter all the files");
+    } else {
+        // display results in main thread
+        if(scan_modes.at(currentMode).display_function) {
+            scan_modes.at(currentMode).display_function(this);
+        }
+    }
+
+    setUiDisabled(false);
+    setCurrentTask("Idle");
+}
+
+void MainWindow::collectScanInputs() {
+    blacklisted_dirs.clear();
+    whitelisted_dirs.clear();
+    scan_catalogs.clear();
+
+    extension_filter_state = (FileUtils::ExtenstionFilterState)ui->extention_filter_enabled_checkbox->checkState();
+
+    for(int i = 0; i < ui->folders_to_scan_list->count(); i++) {
+        auto itemWidget = widgetFromList(ui->folders_to_scan_list, i);
+        if(HashCatalog::isCatalogPath(itemWidget->getText())) {
+            scan_catalogs.append(itemWidget->getText());
+        } else if(itemWidget->isWhitelisted()) {
+            whitelisted_dirs.append(itemWidget->getText());
+        } else {
+            blacklisted_dirs.append(itemWidget->getText());
+        }
+    }
+
+    listed_exts.clear();
+    if(extension_filter_state != FileUtils::DISABLED) {
+        listed_exts = getAllStringsFromList(ui->extension_filter_list);
+    }
+}
+
+void MainWindow::resetScanState() {
     ui->app_output_label->setText("Last app output:");
     total_files.reset();
     preprocessed_files.reset();
@@ -419,14 +506,23 @@ void MainWindow::onStartScanButtonClicked() {
     preloaded_files.reset();
     indexed_files.clear();
     master_files.clear();
+    file_table.clear();
+    dedupe_resuts.clear();
+    scan_error.clear();
     averageFilesPerSecond = 0;
     startNewLog();
+}
 
-    setUiDisabled(true);
-
+bool MainWindow::runScanInBackground() {
+    scan_running = true;
     scan_start_time = QDateTime::currentMSecsSinceEpoch();
     etaMode = EtaMode::ENABLED;
 
+    // the watcher's writes would race with the scan's (and with index maintenance), changes wait for the scan to end
+    if(index_watcher) {
+        index_watcher->pause();
+    }
+
     QEventLoop loop;
     QFutureWatcher<bool> futureWatcher;
 
@@ -435,18 +531,12 @@ void MainWindow::onStartScanButtonClicked() {
     futureWatcher.setFuture(QtConcurrent::run(this, &MainWindow::startScanAsync));
     loop.exec();
 
-    if(!futureWatcher.result()) {
-        displayWarning("Nothing to scan, your filters filter all the files");
-    } else {
-        // display results in main thread
-        etaMode = EtaMode::DISABLED;
-        if(scan_modes.at(currentMode).display_function) {
-            scan_modes.at(currentMode).display_function(this);
-        }
+    etaMode = EtaMode::DISABLED;
+    scan_running = false;
+    if(index_watcher) {
+        index_watcher->resume();
     }
-
-    setUiDisabled(false);
-    setCurrentTask("Idle");
+    return futureWatcher.result();
 }
 
 #pragma endregion}
@@ -624,8 +714,10 @@ void MainWindow::setUiDisabled(bool disabled) {
 
     ui->add_extention_button->setDisabled(disabled);
     ui->add_scan_folder_button->setDisabled(disabled);
+    ui->add_catalog_button->setDisabled(disabled);
 
     ui->set_master_folder_button->setDisabled(disabled);
+    ui->set_master_catalog_button->setDisabled(disabled);
     ui->set_dupes_folder_button->setDisabled(disabled);
 
     ui->start_scan_button->setDisabled(disabled);
@@ -647,70 +739,112 @@ void MainWindow::startNewLog() {
 
 #pragma region MainWindow duper functions {
 
-template<typename T>
-void MainWindow::removeDuplicates(T &arr) {
-    std::sort(arr.begin(), arr.end());
-    arr.erase(std::unique(arr.begin(), arr.end()), arr.end());
-}
-
 bool MainWindow::startScanAsync() {
 
-    QStringList blacklisted_dirs;
+    // directory ids of the previous scan's file table are reused
+    db_writer->invalidateDirCache();
 
-    extension_filter_state = (FileUtils::ExtenstionFilterState)ui->extention_filter_enabled_checkbox->checkState();
-
-    for(int i = 0; i < ui->folders_to_scan_list->count(); i++) {
-        auto itemWidget = widgetFromList(ui->folders_to_scan_list, i);
-        if(!itemWidget->isWhitelisted()) {
-            blacklisted_dirs.append(itemWidget->getText());
-        }
+    if(!scan_modes.at(currentMode).uses_folders) {
+        QSqlDatabase storage_db = DbUtils::openDbConnection();
+        scan_modes.at(currentMode).process_function(this, storage_db);
+        return true;
     }
 
-    if(extension_filter_state != FileUtils::DISABLED) {
-        listed_exts = getAllStringsFromList(ui->extension_filter_list);
+    if(!scan_modes.at(currentMode).enumerate_files) {
+        QSqlDatabase storage_db = DbUtils::openDbConnection();
+        runScheduledIndexMaintenance(storage_db);
+        scan_modes.at(currentMode).process_function(this, storage_db);
+        db_writer->flush();
+        return true;
     }
 
-    for(int i = 0; i < ui->folders_to_scan_list->count(); i++){
-        auto itemWidget = widgetFromList(ui->folders_to_scan_list, i);
-        if(itemWidget->isWhitelisted()) {
-            walkDir(itemWidget->getText(), blacklisted_dirs, listed_exts,
-                    extension_filter_state,
-                    [this](QString file) {addEnumeratedFile(file, indexed_files);});
-        }
+    for(auto& dir: whitelisted_dirs) {
+        walkDirByDirectory(dir, blacklisted_dirs, listed_exts, extension_filter_state,
+                           [this](const QString& dir_path, const QFileInfoList& files) {addEnumeratedFiles(dir_path, files, file_table);});
     }
 
-    quint64 size = 0;
-    for(auto& file: indexed_files) {
-        size += file.size_bytes;
+    // catalogs stand in for their (unmounted) folders (only listed for modes that use them)
+    for(auto& catalog: scan_catalogs) {
+        MultiFile catalog_files;
+        loadCatalog(catalog, catalog_files);
+        for(auto& file: catalog_files) {
+            file_table.append(file);
+        }
     }
-    qInfo() << FileUtils::bytesToReadable(size);
 
     // remove duplicates
-    removeDuplicates(indexed_files);
+    file_table.removeDuplicatePaths();
+
+    // hard links would be hashed again and found as duplicates that free no space
+    if(scan_modes.at(currentMode).collapse_hard_links) {
+        reportHardLinks(file_table.removeHardLinks());
+    }
 
-    if(indexed_files.empty()) {
+    if(file_table.isEmpty()) {
         return false;
     }
 
     // recalculate after removing duplicates
     total_files.reset();
-    for(auto& file: indexed_files) {
-        total_files += file;
+    for(int i = 0; i < file_table.size(); i++) {
+        if(!file_table.isOffline(i)) {
+            total_files.add(file_table.sizeBytes(i));
+        }
     }
+    qInfo() << FileUtils::bytesToReadable(total_files.size());
 
-    // open a connection from this thread
+    // the other modes work on full File objects
+    if(!scan_modes.at(currentMode).compact_files) {
+        indexed_files = file_table.files();
+        file_table.clear();
+    }
+
+    // open a connection from this thread (reads only, writes go through db_writer)
     QSqlDatabase storage_db = DbUtils::openDbConnection();
-    storage_db.transaction();
-    qInfo() << "Started db transaction";
+
+    runScheduledIndexMaintenance(storage_db);
 
     scan_modes.at(currentMode).process_function(this, storage_db);
 
-    storage_db.commit();
-    storage_db.close();
-    qInfo() << "Db commit";
+    // make sure the results are stored before the next scan reads them
+    db_writer->flush();
+    qInfo() << "Db writes flushed";
     return true;
 }
 
+void MainWindow::runScheduledIndexMaintenance(QSqlDatabase db) {
+    // 0 disables scheduled maintenance, the mode can still be run manually
+    int interval_days = scanSetting("index_maintenance_interval_days", 7).toInt();
+    if(interval_days <= 0) {
+        return;
+    }
+    QDateTime last_run = scanSetting("last_index_maintenance").toDateTime();
+    // the interval starts with the first scan, not with an unannounced maintenance run
+    if(!last_run.isValid()) {
+        QSettings(QSettings::UserScope, "disk_deduper_qt", "ui_state").setValue("last_index_maintenance", QDateTime::currentDateTime());
+        return;
+    }
+    if(last_run.addDays(interval_days) > QDateTime::currentDateTime()) {
+        return;
+    }
+    qInfo() << QString("Running scheduled index maintenance (last run %1, every %2 days)").arg(last_run.toString(Qt::ISODate)).arg(interval_days);
+    runIndexMaintenance(db, false);
+    qInfo().noquote() << maintenance_report;
+}
+
+QString MainWindow::loadCatalog(const QString& catalog_path, MultiFile& files) {
+    HashCatalog catalog;
+    if(!catalog.open(catalog_path)) {
+        return QString();
+    }
+    qInfo() << QString("Using catalog %1 of %2 (volume %3, %4 files)").arg(catalog_path, catalog.root(), catalog.volume()).arg(catalog.size());
+    files.reserve(files.size() + catalog.size());
+    for(int i = 0; i < catalog.size(); i++) {
+        files.append(catalog.file(i));
+    }
+    return catalog.volume();
+}
+
 void MainWindow::addEnumeratedFile(const QString& file, MultiFile& files) {
     QFile file_r = file;
     if(files.size() % 100 == 0) {
@@ -720,18 +854,72 @@ void MainWindow::addEnumeratedFile(const QString& file, MultiFile& files) {
     files.push_back({file});
 }
 
-void MainWindow::hashAllFiles(QSqlDatabase db, MultiFile& files, File::HashType hash_type, const std::function<void(File&)>& callback) {
-    // threaded hash loading
-    QVector<QFuture<void>> futures;
-    for (auto& file: files) {
-        setCurrentTask(QString("Hashing file: %1").arg(file));
-        futures.append(file.loadHash(db, hash_type));
+void MainWindow::reportHardLinks(const QVector<QStringList>& link_sets) {
+    if(link_sets.isEmpty()) {
+        return;
+    }
+    int links = 0;
+    for(auto& paths: link_sets) {
+        links += paths.size() - 1;
     }
-    // save to db if the hash was computed
+    qInfo() << QString("%1 paths are hard links (or other paths) of %2 files, each file is processed once").arg(links).arg(link_sets.size());
+    for(auto& paths: link_sets) {
+        qInfo() << "Same file:" << paths.join(" = ");
+    }
+}
+
+void MainWindow::addEnumeratedFiles(const QString& dir, const QFileInfoList& files, FileTable& table) {
+    setCurrentTask(QString("Enumerating folder: %1").arg(dir));
+    // the path is stored once for all files of the directory
+    quint32 dir_id = table.internDir(dir);
+    for(const auto& info: files) {
+        table.append(dir_id, info);
+        total_files.add(info.size());
+    }
+}
+
+void MainWindow::hashAllFiles(FileTable& table, const QVector<quint32>& indexes, File::HashType hash_type, const std::function<void(quint32)>& callback) {
+    // a File only exists while its file is hashed, the hashes go back into the table
+    // only a window of files is in flight, cache hits finish faster than they are consumed
+    const int window = QThreadPool::globalInstance()->maxThreadCount() * hash_window_per_thread;
+    QQueue<QFuture<QPair<bool, File>>> futures;
+    int next = 0;
+    for(int i = 0; i < indexes.size(); i++) {
+        for(; next < indexes.size() && next - i < window; next++) {
+            quint32 index = indexes[next];
+            setCurrentTask(QString("Hashing file: %1").arg(table.fullPath(index)));
+            futures.enqueue(QtConcurrent::run([&table, index, hash_type]() {
+                File file = table.file(index);
+                bool computed = file.loadHashBlocking(hash_type);
+                return qMakePair(computed, file);
+            }));
+        }
+        // save to db if the hash was computed
+        auto result = futures.dequeue().result();
+        File& file = result.second;
+        if(result.first) {
+            file.saveHashToDb(db_writer.get());
+        }
+        table.update(indexes[i], file);
+        setCurrentTask(QString("Hashed file: %1").arg(file));
+        callback(indexes[i]);
+        (hash_type == File::PARTIAL ? preprocessed_files : processed_files) += file;
+    }
+}
+
+void MainWindow::hashAllFiles(MultiFile& files, File::HashType hash_type, const std::function<void(File&)>& callback) {
+    // threaded hash loading, a window of files is in flight
+    const int window = QThreadPool::globalInstance()->maxThreadCount() * hash_window_per_thread;
+    QQueue<QFuture<bool>> futures;
+    int next = 0;
     for(int i = 0; i < files.size(); i++) {
-        if(!futures[i].isCanceled()) {
-            futures[i].waitForFinished();
-            files[i].saveHashToDb(db);
+        for(; next < files.size() && next - i < window; next++) {
+            setCurrentTask(QString("Hashing file: %1").arg(files[next]));
+            futures.enqueue(files[next].loadHash(hash_type));
+        }
+        // save to db if the hash was computed
+        if(futures.dequeue().result()) {
+            files[i].saveHashToDb(db_writer.get());
         }
         setCurrentTask(QString("Hashed file: %1").arg(files[i]));
         callback(files[i]);
@@ -742,12 +930,13 @@ void MainWindow::hashAllFiles(QSqlDatabase db, MultiFile& files, File::HashType
 void MainWindow::loadAllMetadataFromFiles(QSqlDatabase db, const QString& datetime_format,
                                           MultiFile& files_all, const std::function<bool (File &)> &callback) {
 
-    MultiFile files;
+    // files without cached metadata (point into files_all)
+    QVector<File*> files;
     for(auto& file: files_all) {
         // check if we need to get metadata using exiftool
         setCurrentTask(QString("Checking db data of file: %1").arg(file));
         if(!file.loadMetadataFromDb(db)) {
-            files.append(file);
+            files.append(&file);
         } else {
             preprocessed_files += file;
             processed_files += file;
@@ -757,100 +946,145 @@ void MainWindow::loadAllMetadataFromFiles(QSqlDatabase db, const QString& dateti
         }
     }
 
-    // split into chunks for multithreaded processing
-
+    // every worker claims the next unprocessed file from a shared counter,
+    // so slow files (large videos, network mounts) don't leave the other workers idle
+    QAtomicInt next_file = 0;
     QVector<QFuture<void>> futures;
-    if(files.size() / idealThreadCount > 100) {
-        for(int offset = 0; offset < ex_tools.size(); offset++) {
-            futures.append(QtConcurrent::run([&files, this, offset, &datetime_format]() {
-                for(int i = offset; i < files.size(); i+= idealThreadCount) {
-                    setCurrentTask(QString("Getting info about file: %1").arg(files[i]));
-                    files[i].loadMetadataFromExifTool(ex_tools[offset], datetime_format);
-                    preprocessed_files += files[i];
+    for(int worker = 0; worker < qMin(idealThreadCount, files.size()); worker++) {
+        futures.append(QtConcurrent::run([&files, &next_file, this, &datetime_format]() {
+            // exiftool is only started for files we can't read ourselves
+            ExifToolPool::Lease ex_tool(ex_tool_pool.get());
+            for(int i = next_file.fetchAndAddRelaxed(1); i < files.size(); i = next_file.fetchAndAddRelaxed(1)) {
+                File& file = *files[i];
+                setCurrentTask(QString("Getting info about file: %1").arg(file));
+                if(!file.loadMetadataNative(datetime_format)) {
+                    file.loadMetadataFromExifTool(ex_tool.get(), datetime_format);
                 }
-            }));
-        }
-    } else {
-        for(auto& file: files) {
-            setCurrentTask(QString("Getting info about file: %1").arg(file));
-            file.loadMetadataFromExifTool(ex_tools[0], datetime_format);
-            preprocessed_files += file;
-        }
+                preprocessed_files += file;
+            }
+        }));
     }
 
-    // save to db if the metadata was loaded
     for(auto& future: futures) {
         future.waitForFinished();
     }
 
-    for(auto& file: files) {
-        setCurrentTask(QString("Got info about file: %1").arg(file));
-        file.saveMetadataToDb(db);
-        if(!callback(file)) {
+    // save to db if the metadata was loaded
+    for(auto file: files) {
+        setCurrentTask(QString("Got info about file: %1").arg(*file));
+        file->saveMetadataToDb(db_writer.get());
+        if(!callback(*file)) {
             break;
         }
-        processed_files += file;
+        processed_files += *file;
     }
 }
 
-void MainWindow::loadAllThumbnailsFromFiles(QSqlDatabase db, MultiFile& files) {
+void MainWindow::loadAllThumbnailsFromFiles(MultiFile& files, const FileIndexes& indexes) {
     // threaded thumbnail genration
-    QVector<QFuture<void>> futures;
-    for (auto& file: files) {
-        setCurrentTask(QString("Getting preview for file: %1").arg(file));
-        futures.append(file.loadThumbnail(db));
+    QVector<QFuture<bool>> futures;
+    for (auto index: indexes) {
+        setCurrentTask(QString("Getting preview for file: %1").arg(files[index]));
+        futures.append(files[index].loadThumbnail());
     }
     // save to db if the thumbnail was loaded
-    for(int i = 0; i < files.size(); i++) {
-        if(!futures.at(i).isCanceled()) {
-            futures[i].waitForFinished();
-            files[i].postLoadThumbnail();
-            files[i].saveThumbnailToDb(db);
-        };
-        setCurrentTask(QString("Got preview for file: %1").arg(files[i]));
-        preloaded_files += files[i];
+    for(int i = 0; i < indexes.size(); i++) {
+        File& file = files[indexes[i]];
+        bool loaded = futures[i].result();
+        // cached thumbnails are kept, the rest falls back to a file type icon
+        file.postLoadThumbnail();
+        if(loaded) {
+            file.saveThumbnailToDb(db_writer.get());
+        }
+        setCurrentTask(QString("Got preview for file: %1").arg(file));
+        preloaded_files += file;
     }
 }
 
 
+// key files are grouped by in each mode
+template<FileField field>
+struct GroupKey;
+template<>
+struct GroupKey<FileField::HASH> { typedef Digest type; };
+template<>
+struct GroupKey<FileField::NAME> { typedef QString type; };
+template<>
+struct GroupKey<FileField::PHASH> { typedef QByteArray type; };
+
 template<FileField field>
-void MainWindow::findDuplicateFiles(QSqlDatabase db) {
+void MainWindow::findDuplicateFiles() {
+
+    // "hash_map" (default) or "radix_sort", phashes are compared by similarity and always use the map
+    const bool sort_grouping = scanSetting("grouping_backend").toString() == "radix_sort";
 
-    MultiFile indexed_files_filtered;
     if constexpr(field == FileField::HASH) {
 
-        // map of groups of files with the same partial hash
-        QMap<QByteArray, MultiFile> probably_duplicate_files_map;
-        hashAllFiles(db, indexed_files, File::PARTIAL, [&probably_duplicate_files_map](File& file) {
-            probably_duplicate_files_map[file.partial_hash].append(file);
-        });
+        // files stay in the table until they share a partial hash with another file
+        // (offline catalog entries come with their hashes)
+        QVector<quint32> candidates;
+        if(sort_grouping) {
+            hashAllFiles(file_table, file_table.indexes(), File::PARTIAL);
+            QVector<SortGrouping::Record> records;
+            records.reserve(file_table.size());
+            for(quint32 index = 0; index < (quint32)file_table.size(); index++) {
+                // unreadable files can't be compared
+                if(file_table.hasPartialHash(index)) {
+                    records.append({SortGrouping::keyOf(file_table.partialHash(index)), file_table.sizeBytes(index), index});
+                }
+            }
+            const auto groups = SortGrouping::findGroups(records, [this](quint32 a, quint32 b) {
+                return file_table.partialHash(a) == file_table.partialHash(b);
+            });
+            for(auto& fileGroup: groups) {
+                candidates.append(fileGroup);
+            }
+        } else {
+            FlatGroupMap<Digest, FileIndexes> probably_duplicate_files_map(file_table.size());
+            hashAllFiles(file_table, file_table.indexes(), File::PARTIAL, [this, &probably_duplicate_files_map](quint32 index) {
+                // unreadable files can't be compared
+                if(file_table.hasPartialHash(index)) {
+                    probably_duplicate_files_map[file_table.partialHash(index)].append(index);
+                }
+            });
 
-        for(auto& fileGroup: probably_duplicate_files_map) {
-            if(fileGroup.size() > 1) {
-                indexed_files_filtered.append(fileGroup);
+            for(auto& fileGroup: probably_duplicate_files_map.allValues()) {
+                if(fileGroup.size() > 1) {
+                    candidates.append(fileGroup);
+                }
             }
         }
 
-        hashAllFiles(db, indexed_files_filtered, File::FULL);
-    } else {
-        indexed_files_filtered = indexed_files;
+        // only the candidates become File objects, groups refer to them by index
+        hashAllFiles(file_table, candidates, File::FULL, [this](quint32 index) {
+            indexed_files.append(file_table.file(index));
+        });
     }
 
     if constexpr(field == FileField::PHASH) {
-        hashAllFiles(db, indexed_files_filtered, File::PERCEPTUAL);
+        hashAllFiles(indexed_files, File::PERCEPTUAL);
+    } else {
+        if(sort_grouping) {
+            buildDedupeResults(sortDuplicateGroups<field>());
+            return;
+        }
     }
 
     // map of groups of files with the same key field (name or hash)
-    QMap<QByteArray, MultiFile> duplicate_files_map;
+    FlatGroupMap<typename GroupKey<field>::type, FileIndexes> duplicate_files_map(indexed_files.size());
 
     // we group all files with the same key field
-    for(auto& file: indexed_files_filtered) {
+    for(quint32 index = 0; index < (quint32)indexed_files.size(); index++) {
+        const File& file = indexed_files.at(index);
 
-        QByteArray value;
+        typename GroupKey<field>::type value;
         if constexpr(field == FileField::NAME) {
-            value = file.name.toLower().toUtf8();
+            value = file.name.toLower();
         } else if constexpr(field == FileField::HASH) {
-            value = file.hash;
+            // files that couldn't be read have no hash
+            if(!FileTable::storeDigest(value, file.hash)) {
+                continue;
+            }
         } else if constexpr(field == FileField::PHASH) {
             // no perceptual hash for file (file is not an image / video)
             if(file.perceptual_hash.isEmpty()) {
@@ -860,22 +1094,13 @@ void MainWindow::findDuplicateFiles(QSqlDatabase db) {
 
         // normal equals comparison
         if constexpr(field == FileField::NAME || field == FileField::HASH) {
-            setCurrentTask(QString("Comparing: %1").arg(file));
-            if(duplicate_files_map.contains(value)) {
-                // we have our first hit, this means that the first file is unique
-                if(duplicate_files_map[value].size() == 1) {
-                    unique_files += file;
-                }
-                duplicate_files += file;
-            }
-            duplicate_files_map[value].append(file);
+            addToDuplicateGroups(duplicate_files_map, value, index);
         // perceptual hashes need to be compared differently
         } else {
-            const auto unique_hashes = duplicate_files_map.keys();
             bool found_similar = false;
-            for(const auto& uhash: unique_hashes) {
-                if(FileUtils::comparePerceptualHashes(file.perceptual_hash, uhash, currentSimilarity)) {
-                    duplicate_files_map[uhash].append(file);
+            for(int i = 0; i < duplicate_files_map.size(); i++) {
+                if(FileUtils::comparePerceptualHashes(file.perceptual_hash, duplicate_files_map.keyAt(i), currentSimilarity)) {
+                    duplicate_files_map.valueAt(i).append(index);
                     duplicate_files += file;
                     found_similar = true;
                     break;
@@ -883,11 +1108,67 @@ void MainWindow::findDuplicateFiles(QSqlDatabase db) {
             }
             if(!found_similar) {
                 unique_files += file;
-                duplicate_files_map[file.perceptual_hash].append(file);
+                duplicate_files_map[file.perceptual_hash].append(index);
+            }
+        }
+    }
+
+    buildDedupeResults(duplicate_files_map.allValues());
+}
+
+template<FileField field>
+QVector<FileIndexes> MainWindow::sortDuplicateGroups() {
+    setCurrentTask("Sorting files");
+    QVector<SortGrouping::Record> records;
+    records.reserve(indexed_files.size());
+    for(quint32 index = 0; index < (quint32)indexed_files.size(); index++) {
+        const File& file = indexed_files.at(index);
+        if constexpr(field == FileField::NAME) {
+            records.append({SortGrouping::keyOf(file.name.toLower()), 0, index});
+        } else {
+            Digest hash;
+            // files that couldn't be read have no hash
+            if(FileTable::storeDigest(hash, file.hash)) {
+                records.append({SortGrouping::keyOf(hash), file.size_bytes, index});
             }
         }
     }
 
+    const auto groups = SortGrouping::findGroups(records, [this](quint32 a, quint32 b) {
+        if constexpr(field == FileField::NAME) {
+            return indexed_files.at(a).name.toLower() == indexed_files.at(b).name.toLower();
+        } else {
+            return indexed_files.at(a).hash == indexed_files.at(b).hash;
+        }
+    });
+
+    // the first file of a group is the unique one
+    for(auto& group: groups) {
+        unique_files += indexed_files.at(group.first());
+        for(int i = 1; i < group.size(); i++) {
+            duplicate_files += indexed_files.at(group.at(i));
+        }
+    }
+    return groups;
+}
+
+template<typename Key>
+void MainWindow::addToDuplicateGroups(FlatGroupMap<Key, FileIndexes>& duplicate_files_map, const Key& value, quint32 index) {
+    const File& file = indexed_files.at(index);
+    setCurrentTask(QString("Comparing: %1").arg(file));
+    FileIndexes& group = duplicate_files_map[value];
+    // we have our first hit, this means that the first file is unique
+    if(group.size() == 1) {
+        unique_files += file;
+    }
+    if(!group.isEmpty()) {
+        duplicate_files += file;
+    }
+    group.append(index);
+}
+
+void MainWindow::buildDedupeResults(const QVector<FileIndexes>& duplicate_groups) {
+
     // map of fingerprint-to-multiFile, fingerprint will be the same in two groups if files in 2 groups group have the same dupe locations
 
     // example
@@ -895,14 +1176,14 @@ void MainWindow::findDuplicateFiles(QSqlDatabase db) {
     // group2: /testdir3/image1.png, /testdir/image.png, /testdir2/image3.png
     // fingerprint will be the same
 
-    QMap<QByteArray, MultiFileGroup> multiFiles_fingerprintMatched;
+    FlatGroupMap<QByteArray, MultiFileGroup> multiFiles_fingerprintMatched;
 
     // we group all groups bigger than 1 (at least one duplicate) with the same fingerprint
-    for(auto& multiFile: duplicate_files_map) {
+    for(auto& multiFile: duplicate_groups) {
         if(multiFile.size() > 1) {
             // load thumbnails while we are here
-            loadAllThumbnailsFromFiles(db, multiFile);
-            multiFiles_fingerprintMatched[FileUtils::getFileGroupFingerprint(multiFile)].append(multiFile);
+            loadAllThumbnailsFromFiles(indexed_files, multiFile);
+            multiFiles_fingerprintMatched[FileUtils::getFileGroupFingerprint(indexed_files, multiFile)].append(multiFile);
         }
     }
 
@@ -926,7 +1207,7 @@ void MainWindow::findDuplicateFiles(QSqlDatabase db) {
     //)
     //)
 
-    const QList<MultiFileGroup> dedupe_resuts_intermediate = multiFiles_fingerprintMatched.values();
+    const QVector<MultiFileGroup>& dedupe_resuts_intermediate = multiFiles_fingerprintMatched.allValues();
 
     dedupe_resuts.clear();
     for(const auto& group_of_groups: dedupe_resuts_intermediate) {
@@ -948,15 +1229,255 @@ void MainWindow::findDuplicateFiles(QSqlDatabase db) {
 }
 
 void MainWindow::hashCompare(QSqlDatabase db) {
-    findDuplicateFiles<FileField::HASH>(db);
+    findDuplicateFiles<FileField::HASH>();
+}
+
+void MainWindow::indexedHashCompare(QSqlDatabase db) {
+
+    // directories under the selected folders, as a range on the directories.path index
+    DbUtils::execQuery(db, "CREATE TEMP TABLE IF NOT EXISTS scan_dirs (id INTEGER PRIMARY KEY)");
+    DbUtils::execQuery(db, "DELETE FROM scan_dirs");
+
+    // binds: dir, dir prefix, end of the prefix range
+    const QString dirs_under = "SELECT id FROM directories WHERE path = ? OR (path >= ? AND path < ?)";
+    QSqlQuery add_dirs(db);
+    add_dirs.prepare("INSERT OR IGNORE INTO scan_dirs " + dirs_under);
+    QSqlQuery remove_dirs(db);
+    remove_dirs.prepare("DELETE FROM scan_dirs WHERE id IN (" + dirs_under + ")");
+
+    for(auto [query, dirs]: {qMakePair(&add_dirs, &whitelisted_dirs), qMakePair(&remove_dirs, &blacklisted_dirs)}) {
+        for(auto& dir: *dirs) {
+            QString path = QDir(dir).absolutePath();
+            QString prefix = path.endsWith('/') ? path : path + '/';
+            // '0' follows '/', so this covers everything starting with prefix
+            QString prefix_end = prefix.left(prefix.size() - 1) + '0';
+            query->bindValue(0, path);
+            query->bindValue(1, prefix);
+            query->bindValue(2, prefix_end);
+            DbUtils::execQuery(*query);
+        }
+    }
+
+    // groups of same size and hash are found by sqlite, only their members are returned
+    setCurrentTask("Querying duplicates from index");
+    QSqlQuery query(db);
+    query.setForwardOnly(true);
+    query.prepare("WITH scoped AS ("
+                  "    SELECT f.dir_id, f.name, f.size, f.mtime, h.hash FROM scan_dirs s "
+                  "    JOIN files f ON f.dir_id = s.id JOIN hashes h ON h.file_id = f.id "
+                  "    WHERE length(h.hash) > 0), "
+                  "dupes AS (SELECT size, hash FROM scoped GROUP BY size, hash HAVING COUNT(*) > 1) "
+                  "SELECT d.path, scoped.name, scoped.size, scoped.mtime, scoped.hash FROM scoped "
+                  "JOIN dupes ON dupes.size = scoped.size AND dupes.hash = scoped.hash "
+                  "JOIN directories d ON d.id = scoped.dir_id");
+    DbUtils::execQuery(query);
+
+    // only the candidates are checked against the filesystem
+    FileIndexes changed_files;
+    while(query.next()) {
+        QString full_path = QDir(query.value(0).toString()).filePath(query.value(1).toString());
+        if(!FileUtils::passesExtensionFilter(query.value(1).toString(), listed_exts, extension_filter_state)) {
+            continue;
+        }
+        if(!QFileInfo::exists(full_path)) {
+            qDebug() << "Indexed file no longer exists:" << full_path;
+            continue;
+        }
+        setCurrentTask(QString("Checking: %1").arg(full_path));
+        File file(full_path);
+        total_files += file;
+        if(file.size_bytes == query.value(2).toLongLong()
+                && (query.value(3).isNull() || file.mtime_ms == query.value(3).toLongLong())) {
+            file.hash = query.value(4).toByteArray();
+            file_table.append(file);
+            processed_files += file;
+        } else {
+            changed_files.append(file_table.append(file));
+        }
+    }
+
+    // files changed since they were indexed get hashed again
+    hashAllFiles(file_table, changed_files, File::FULL);
+    indexed_files = file_table.files();
+
+    FlatGroupMap<Digest, FileIndexes> duplicate_files_map(indexed_files.size());
+    for(quint32 index = 0; index < (quint32)indexed_files.size(); index++) {
+        Digest hash;
+        if(FileTable::storeDigest(hash, indexed_files.at(index).hash)) {
+            addToDuplicateGroups(duplicate_files_map, hash, index);
+        }
+    }
+
+    buildDedupeResults(duplicate_files_map.allValues());
+}
+
+void MainWindow::externalHashCompare(QSqlDatabase db) {
+    // two sorters are open at a time, one is read while the next stage fills the other
+    qint64 budget_bytes = scanSetting("external_memory_budget_mb", 512).toLongLong() * 1024 * 1024 / 2;
+    QString sort_dir = scanSetting("external_sort_dir", QDir::tempPath()).toString();
+
+    // files of the same size (records: size, path)
+    auto by_size = std::make_unique<ExternalSorter>(sort_dir, sizeof(qint64), budget_bytes);
+    bool ok = true;
+    // the walker can't be stopped, after a failed write the rest of the folders is only listed
+    for(auto& dir: whitelisted_dirs) {
+        if(!ok) {
+            break;
+        }
+        walkDirByDirectory(dir, blacklisted_dirs, listed_exts, extension_filter_state,
+                           [this, &by_size, &ok](const QString& dir_path, const QFileInfoList& files) {
+            if(!ok) {
+                return;
+            }
+            setCurrentTask(QString("Enumerating folder: %1").arg(dir_path));
+            for(const auto& info: files) {
+                ok = ok && by_size->add(ExternalSorter::sizeKey(info.size()), info.absoluteFilePath());
+                total_files.add(info.size());
+            }
+        });
+    }
+    if(!ok || !by_size->finish()) {
+        scan_error = QString("Failed writing sort files to %1, see the log (is there enough free space?)").arg(sort_dir);
+        return;
+    }
+    qInfo() << QString("Enumerated %1 files, %2 sort runs on disk").arg(by_size->recordCount()).arg(by_size->spilledRuns());
+
+    // files of the same size and partial hash (records: size + partial hash, path)
+    auto by_partial_hash = std::make_unique<ExternalSorter>(sort_dir, sizeof(qint64) + digest_size, budget_bytes);
+    if(!hashDuplicateKeys(*by_size, *by_partial_hash, File::PARTIAL)) {
+        scan_error = QString("Failed sorting files by partial hash in %1, see the log").arg(sort_dir);
+        return;
+    }
+    by_size.reset();
+
+    // files of the same size and hash (records: size + hash, path)
+    auto by_hash = std::make_unique<ExternalSorter>(sort_dir, sizeof(qint64) + digest_size, budget_bytes);
+    if(!hashDuplicateKeys(*by_partial_hash, *by_hash, File::FULL)) {
+        scan_error = QString("Failed sorting files by hash in %1, see the log").arg(sort_dir);
+        return;
+    }
+    by_partial_hash.reset();
+
+    // only the duplicates are kept in memory
+    QVector<FileIndexes> groups;
+    QByteArray key;
+    QByteArray group_key;
+    QString path;
+    QStringList group_paths;
+    while(by_hash->nextDuplicate(key, path)) {
+        if(key != group_key) {
+            addDuplicatePaths(group_paths, group_key.mid(sizeof(qint64)), groups);
+            group_paths.clear();
+            group_key = key;
+        }
+        group_paths.append(path);
+    }
+    if(by_hash->hasError()) {
+        scan_error = QString("Failed reading sort files in %1, see the log").arg(sort_dir);
+        return;
+    }
+    addDuplicatePaths(group_paths, group_key.mid(sizeof(qint64)), groups);
+    showDuplicatePathGroups(groups);
+}
+
+void MainWindow::shardedHashCompare(QSqlDatabase db) {
+    ShardCoordinator::Options options;
+    options.roots = whitelisted_dirs;
+    options.blacklisted_dirs = blacklisted_dirs;
+    options.extensions = listed_exts;
+    options.extension_filter_state = extension_filter_state;
+    options.workers = scanSetting("shard_workers", 4).toInt();
+    options.memory_budget_bytes = scanSetting("external_memory_budget_mb", 512).toLongLong() * 1024 * 1024;
+    options.work_dir = scanSetting("external_sort_dir", QDir::tempPath()).toString();
+
+    ShardCoordinator coordinator(options);
+    if(!coordinator.run([this](const QString& status) { setCurrentTask(status); })) {
+        qWarning() << "Sharded scan failed";
+        scan_error = QString("The shard workers failed, see the log (work folder %1)").arg(options.work_dir);
+        return;
+    }
+    total_files.add((qint32)coordinator.totalFiles(), coordinator.totalBytes());
+
+    // hashes computed by the workers are cached like the ones of a normal scan
+    setCurrentTask("Merging shard indexes");
+    db_writer->flush();
+    if(!coordinator.mergePartialIndexes(db)) {
+        qWarning() << "Some shard indexes could not be merged, their hashes will be computed again by the next scan";
+    }
+
+    QVector<FileIndexes> groups;
+    for(auto& group: coordinator.duplicateGroups()) {
+        addDuplicatePaths(group.second, group.first.mid(sizeof(qint64)), groups);
+    }
+    showDuplicatePathGroups(groups);
+}
+
+void MainWindow::addDuplicatePaths(const QStringList& paths, const QByteArray& hash, QVector<FileIndexes>& groups) {
+    // overlapping folders and hard links list the same file more than once
+    QSet<QPair<quint64, quint64>> identities;
+    FileIndexes group;
+    for(auto& path: paths) {
+        File file(path);
+        if(!file.valid || identities.contains({file.device, file.inode})) {
+            continue;
+        }
+        identities.insert({file.device, file.inode});
+        file.hash = hash;
+        group.append(file_table.append(file));
+    }
+    if(group.size() > 1) {
+        groups.append(group);
+    }
+}
+
+void MainWindow::showDuplicatePathGroups(const QVector<FileIndexes>& groups) {
+    // the table only holds the duplicates, so its files() are indexed like the groups
+    indexed_files = file_table.files();
+    for(auto& group: groups) {
+        unique_files += indexed_files.at(group.first());
+        for(int i = 1; i < group.size(); i++) {
+            duplicate_files += indexed_files.at(group.at(i));
+        }
+    }
+    buildDedupeResults(groups);
+}
+
+bool MainWindow::hashDuplicateKeys(ExternalSorter& input, ExternalSorter& output, File::HashType hash_type) {
+    // files are hashed in batches (through the index cache like in the other modes), the hashes go to the next sorter
+    MultiFile batch;
+    bool ok = true;
+    auto hash_batch = [this, &batch, &output, &ok, hash_type]() {
+        hashAllFiles(batch, hash_type, [&output, &ok, hash_type](File& file) {
+            const QByteArray& hash = hash_type == File::PARTIAL ? file.partial_hash : file.hash;
+            // unreadable files can't be compared
+            if(hash.size() == digest_size) {
+                ok = ok && output.add(ExternalSorter::sizeKey(file.size_bytes) + hash, file.full_path);
+            }
+        });
+        batch.clear();
+    };
+
+    QByteArray key;
+    QString path;
+    while(ok && input.nextDuplicate(key, path)) {
+        batch.append(File(path));
+        if(batch.size() >= external_hash_batch_size) {
+            hash_batch();
+        }
+    }
+    if(!ok || input.hasError()) {
+        return false;
+    }
+    hash_batch();
+    return ok && output.finish();
 }
 
 void MainWindow::phashCompare(QSqlDatabase db) {
-    findDuplicateFiles<FileField::PHASH>(db);
+    findDuplicateFiles<FileField::PHASH>();
 }
 
 void MainWindow::nameCompare(QSqlDatabase db) {
-    findDuplicateFiles<FileField::NAME>(db);
+    findDuplicateFiles<FileField::NAME>();
 }
 
 void MainWindow::autoDedupe_move(QSqlDatabase db) {
@@ -967,31 +1488,80 @@ void MainWindow::autoDedupe_rename(QSqlDatabase db) {
     autoDedupe(db, true);
 }
 
+// identifies a file on the same volume independent of where the volume is mounted
+static QString fileIdentity(const File& file) {
+    return QString("%1|%2|%3").arg(file.size_bytes).arg(file.mtime_ms).arg(file.name);
+}
+
 void MainWindow::autoDedupe(QSqlDatabase db, bool safe) {
-    walkDir(masterFolder, {}, listed_exts,
-                        extension_filter_state,
-                        [this](QString file) {addEnumeratedFile(file, master_files);});
+    // scanned folders on the drive of an offline master, the master's files can be in there under another mount point
+    QStringList master_volume_dirs;
+
+    // an offline master is taken from its catalog as is
+    if(HashCatalog::isCatalogPath(masterFolder)) {
+        QString volume = loadCatalog(masterFolder, master_files);
+        for(auto& dir: whitelisted_dirs) {
+            if(!volume.isEmpty() && HashCatalog::volumeId(dir) == volume) {
+                qWarning() << "The drive of the master catalog is mounted at" << dir << ", its master files are not treated as dupes";
+                master_volume_dirs.append(QDir(dir).absolutePath() + '/');
+            }
+        }
+    } else {
+        walkDir(masterFolder, {}, listed_exts,
+                            extension_filter_state,
+                            [this](QString file) {addEnumeratedFile(file, master_files);});
 
-    hashAllFiles(db, master_files, File::FULL);
+        hashAllFiles(master_files, File::FULL);
+    }
 
-    QMap<QString, File> master_hashes;
-    QSet<QString> master_hashes_hit;
+    // master hashes, the value tells if a dupe of it was found already
+    FlatGroupMap<Digest, bool> master_hashes(master_files.size());
     MultiFile dupes;
 
+    // a master file that is scanned as a slave too would be a dupe of itself
+    QSet<QString> master_paths;
+    QSet<QString> master_identities;
+    for(auto& master_file: master_files) {
+        master_paths.insert(master_file.full_path);
+        if(!master_volume_dirs.isEmpty()) {
+            master_identities.insert(fileIdentity(master_file));
+        }
+    }
+    auto is_master_file = [&](const File& file) {
+        if(master_paths.contains(file.full_path)) {
+            return true;
+        }
+        for(auto& dir: master_volume_dirs) {
+            if(file.full_path.startsWith(dir)) {
+                return master_identities.contains(fileIdentity(file));
+            }
+        }
+        return false;
+    };
+
     for(auto& master_file: master_files) {
-        master_hashes[master_file.hash] = master_file;
+        Digest hash;
+        // unreadable master files can't have dupes
+        if(FileTable::storeDigest(hash, master_file.hash)) {
+            master_hashes[hash] = false;
+        }
     }
 
-    hashAllFiles(db, indexed_files, File::FULL,
-    [this, &master_hashes, &dupes, &master_hashes_hit](const File& file) {
+    hashAllFiles(indexed_files, File::FULL,
+    [this, &master_hashes, &dupes, &is_master_file](const File& file) {
         setCurrentTask(QString("Comparing file: %1").arg(file));
-        if(master_hashes.contains(file.hash)) {
+        Digest hash;
+        if(!FileTable::storeDigest(hash, file.hash) || is_master_file(file)) {
+            return;
+        }
+        bool* hit = master_hashes.find(hash);
+        if(hit) {
             duplicate_files += file;
             dupes.append(file);
-            if (!master_hashes_hit.contains(file.hash)){
+            if (!*hit){
                 // our first hit, increment the number on unique files
                 unique_files += file;
-                master_hashes_hit.insert(file.hash);
+                *hit = true;
             }
         }
     });
@@ -999,6 +1569,15 @@ void MainWindow::autoDedupe(QSqlDatabase db, bool safe) {
     autoDedupe_files = FileUtils::queueFilesToModify(dupes, safe ? "" : dupesFolder, safe ? "_DELETED_" : "");
 }
 
+void MainWindow::exportCatalog(QSqlDatabase db) {
+    // the partial hashes let hash comparisons skip files that can't match
+    hashAllFiles(indexed_files, File::PARTIAL);
+    hashAllFiles(indexed_files, File::FULL);
+
+    setCurrentTask(QString("Writing catalog: %1").arg(catalog_export_path));
+    HashCatalog::write(catalog_export_path, whitelisted_dirs.first(), indexed_files);
+}
+
 void MainWindow::exifRename(QSqlDatabase db) {
     loadAllMetadataFromFiles(db, exifRenameFormat.datetime_format, indexed_files,
     [this](File& file){
@@ -1009,49 +1588,35 @@ void MainWindow::exifRename(QSqlDatabase db) {
 
 void MainWindow::showStats(QSqlDatabase db) {
 
-    QVector<NamedCountableQStringList> meta_fields_stats;
-
-    for (auto& metadata_key: selectedMetaFields) {
-        meta_fields_stats.append({metadata_key, {}});
-    }
-
-    loadAllMetadataFromFiles(db, Constants::datetime_format, indexed_files,
-    [&meta_fields_stats](const File& file){
+    StatsAggregator stats(selectedMetaFields);
 
-        // iterate through name-array pairs
-        for (auto& [metadata_key, metadata_array]: meta_fields_stats) {
-            const QString& metadata_value = file.metadata.value(metadata_key);
+    // cached files are aggregated inside the database
+    setCurrentTask("Aggregating cached statistics");
+    MultiFile uncached_files;
+    FileQuantitySizeCounter cached_files;
+    stats.addCachedFromDb(db, indexed_files, uncached_files, cached_files);
+    preprocessed_files = preprocessed_files + cached_files;
+    processed_files = processed_files + cached_files;
 
-            // if value is already present (for instance extension "png") add to it, othrewise construct a new one
-            if (metadata_array.contains(metadata_value)) {
-                CountableQString& temp = metadata_array[metadata_array.indexOf(metadata_value)];
-                temp.count ++;
-                temp.total_size_bytes += file.size_bytes;
-            } else {
-                metadata_array.append({metadata_value, 1, file.size_bytes});
-            }
-        }
-
-        return true;
-    });
+    // metadata of the rest is kept in the files, aggregation runs afterwards on all cores
+    loadAllMetadataFromFiles(db, Constants::datetime_format, uncached_files);
 
-    // calculate relative percentages for all meta fileds
-    for (auto& [metadata_key, metadata_array]: meta_fields_stats) {
-        for (auto& metadata_value: metadata_array) {
-            metadata_value.count_percentage = metadata_value.count / (double)total_files.num() * 100;
-            metadata_value.size_percentage = metadata_value.total_size_bytes / (long double)total_files.size() * 100;
-        }
-    }
+    setCurrentTask("Aggregating statistics");
+    stats.merge(StatsAggregator::aggregate(selectedMetaFields, uncached_files, idealThreadCount));
 
-    stat_results = {meta_fields_stats, total_files };
+    stat_results = {stats.results(total_files), total_files};
 }
 
 void MainWindow::fileCompare_display() {
+    if(!scan_error.isEmpty()) {
+        displayWarning(scan_error);
+        return;
+    }
     if(dedupe_resuts.empty()) {
        displayWarning("No dupes found");
        return;
     }
-    Dupe_results_dialog dupe_results_dialog(this, dedupe_resuts, duplicate_files);
+    Dupe_results_dialog dupe_results_dialog(this, indexed_files, dedupe_resuts, duplicate_files);
     dupe_results_dialog.setModal(true);
     dupe_results_dialog.exec();
 }
@@ -1067,6 +1632,28 @@ QString MainWindow::showStats_request() {
     return "Nothing selected";
 }
 
+QString MainWindow::exportCatalog_request() {
+    int folders = 0;
+    for(int i = 0; i < ui->folders_to_scan_list->count(); i++) {
+        auto itemWidget = widgetFromList(ui->folders_to_scan_list, i);
+        if(itemWidget->isWhitelisted() && !HashCatalog::isCatalogPath(itemWidget->getText())) {
+            folders ++;
+        }
+    }
+    if(folders != 1) {
+        return "A catalog is made of exactly one folder, please select one folder to scan";
+    }
+    catalog_export_path = QFileDialog::getSaveFileName(this, "Save hash catalog", "",
+                                                       QString("Hash catalogs (*.%1)").arg(HashCatalog::file_extension));
+    if(catalog_export_path.isEmpty()) {
+        return "Nothing to do";
+    }
+    if(!catalog_export_path.endsWith("." + HashCatalog::file_extension)) {
+        catalog_export_path += "." + HashCatalog::file_extension;
+    }
+    return "";
+}
+
 QString MainWindow::exifRename_request() {
     Exif_rename_builder_dialog exif_rename_builder_dialog(this);
     exif_rename_builder_dialog.setModal(true);
@@ -1089,7 +1676,7 @@ QString MainWindow::autoDedupe_request() {
     if(dupesFolder.isEmpty()) {
         return "No duplicate folder specified, can't proceed";
     }
-    if(!QDir(masterFolder).exists()) {
+    if(!QDir(masterFolder).exists() && !HashCatalog::isCatalogPath(masterFolder)) {
         return "Master folder doesn't exist, can't proceed";
     }
     if(!QDir(dupesFolder).exists()) {
@@ -1112,6 +1699,25 @@ void MainWindow::autoDedupe_display() {
     };
 }
 
+void MainWindow::indexMaintenance(QSqlDatabase db) {
+    runIndexMaintenance(db, true);
+}
+
+void MainWindow::runIndexMaintenance(QSqlDatabase db, bool allow_full_vacuum) {
+    // pending writes could recreate pruned rows (the folder watcher is paused while a scan runs)
+    db_writer->flush();
+    auto report = IndexMaintenance::run(db, [this](const QString& status) {setCurrentTask(status);}, allow_full_vacuum);
+    db_writer->invalidateDirCache();
+
+    maintenance_report = report.toString();
+    QSettings(QSettings::UserScope, "disk_deduper_qt", "ui_state").setValue("last_index_maintenance", QDateTime::currentDateTime());
+}
+
+void MainWindow::indexMaintenance_display() {
+    qInfo().noquote() << maintenance_report;
+    QMessageBox::information(this, "Index maintenance", maintenance_report);
+}
+
 void MainWindow::showStats_display() {
     Stats_dialog stats_dialog(this, stat_results);
     stats_dialog.setModal(true);
@@ -1119,3 +1725,194 @@ void MainWindow::showStats_display() {
 }
 
 #pragma endregion}
+
+#pragma region MainWindow Daemon {
+
+static QJsonObject daemonError(const QString& message) {
+    qWarning() << "Daemon request failed:" << message;
+    return {{"ok", false}, {"error", message}};
+}
+
+QJsonObject MainWindow::daemonRequest(const QJsonObject& request) {
+    QString type = request["request"].toString();
+
+    if(type == "status") {
+        QJsonObject reply = {{"ok", true}, {"busy", scan_running},
+                             {"files", total_files.num()}, {"processed_files", processed_files.num()}, {"duplicates", duplicate_files.num()}};
+        if(index_watcher && index_watcher->isWatching()) {
+            reply["watching"] = QJsonArray::fromStringList(index_watcher->watchedRoots());
+            reply["watched_dirs"] = index_watcher->watchedDirs();
+            reply["queued_changes"] = index_watcher->queuedFiles();
+        }
+        return reply;
+    }
+
+    if(type == "modes") {
+        QJsonArray modes;
+        for(const auto& mode: scan_modes) {
+            modes.append(mode.name);
+        }
+        return {{"ok", true}, {"modes", modes}};
+    }
+
+    // the event loop keeps serving requests while a scan runs, they would overwrite its results
+    if(scan_running) {
+        return daemonError("A scan is already running");
+    }
+
+    if(type == "scan") {
+        QString mode_name = request["mode"].toString();
+        for(int mode = 0; mode < scan_modes.size(); mode++) {
+            if(scan_modes.at(mode).name == mode_name) {
+                return daemonScan(mode, request);
+            }
+        }
+        return daemonError("Unknown scan mode " + mode_name);
+    }
+    if(type == "duplicates") {
+        return daemonScan(ScanMode::INDEXED_HASH_COMPARE, request);
+    }
+    if(type == "similar") {
+        return daemonScan(ScanMode::PHASH_COMPARE, request);
+    }
+    if(type == "stats") {
+        return daemonScan(ScanMode::SHOW_STATS, request);
+    }
+    if(type == "watch") {
+        return daemonWatch(request);
+    }
+    if(type == "unwatch") {
+        index_watcher.reset();
+        return {{"ok", true}};
+    }
+    return daemonError("Unknown request " + type);
+}
+
+QJsonObject MainWindow::daemonScan(int mode, const QJsonObject& request) {
+    const ScanModeProperties& properties = scan_modes.at(mode);
+
+    // the other modes ask for their settings (and confirmation) in dialogs
+    if(properties.request_function && mode != ScanMode::SHOW_STATS) {
+        return daemonError(properties.name + " is only available in the ui");
+    }
+
+    // folders of the request replace the ones saved by the ui
+    collectScanInputs();
+    if(request.contains("folders")) {
+        whitelisted_dirs.clear();
+        scan_catalogs.clear();
+        for(const auto& folder: request["folders"].toVariant().toStringList()) {
+            if(HashCatalog::isCatalogPath(folder)) {
+                scan_catalogs.append(folder);
+            } else {
+                whitelisted_dirs.append(folder);
+            }
+        }
+        blacklisted_dirs = request["excluded"].toVariant().toStringList();
+        listed_exts = request["extensions"].toVariant().toStringList();
+        extension_filter_state = listed_exts.isEmpty() ? FileUtils::DISABLED : FileUtils::ENABLED_WHITE;
+    }
+
+    if(properties.uses_folders && whitelisted_dirs.isEmpty() && scan_catalogs.isEmpty()) {
+        return daemonError("Nothing to scan, please add folders");
+    }
+    if(!scan_catalogs.isEmpty() && !properties.uses_catalogs) {
+        return daemonError(properties.name + " can't use hash catalogs");
+    }
+
+    if(mode == ScanMode::SHOW_STATS) {
+        // all fields unless the request names some
+        QStringList fields = getMetaFieldsList();
+        if(request.contains("fields")) {
+            fields = request["fields"].toVariant().toStringList();
+        }
+        selectedMetaFields = fields.toVector();
+    }
+
+    int previous_mode = currentMode;
+    int previous_similarity = currentSimilarity;
+    currentMode = mode;
+    currentSimilarity = request["similarity"].toInt(currentSimilarity);
+
+    resetScanState();
+    QElapsedTimer timer;
+    timer.start();
+    bool scanned = runScanInBackground();
+
+    currentMode = previous_mode;
+    currentSimilarity = previous_similarity;
+    setCurrentTask("Idle");
+
+    if(!scanned) {
+        return daemonError("Nothing to scan, your filters filter all the files");
+    }
+    if(!scan_error.isEmpty()) {
+        return daemonError(scan_error);
+    }
+
+    QJsonObject reply = {{"ok", true}, {"mode", properties.name}, {"elapsed_ms", timer.elapsed()},
+                         {"files", total_files.num()}, {"bytes", (qint64)total_files.size()}, {"duplicates", duplicate_files.num()}};
+    if(mode == ScanMode::SHOW_STATS) {
+        reply["stats"] = statsJson();
+    } else if(mode == ScanMode::INDEX_MAINTENANCE) {
+        reply["report"] = maintenance_report;
+    } else {
+        reply["groups"] = duplicateGroupsJson();
+    }
+    return reply;
+}
+
+QJsonObject MainWindow::daemonWatch(const QJsonObject& request) {
+    // same folders as a scan, the ones saved by the ui unless the request has them
+    collectScanInputs();
+    if(request.contains("folders")) {
+        whitelisted_dirs = request["folders"].toVariant().toStringList();
+        blacklisted_dirs = request["excluded"].toVariant().toStringList();
+        listed_exts = request["extensions"].toVariant().toStringList();
+        extension_filter_state = listed_exts.isEmpty() ? FileUtils::DISABLED : FileUtils::ENABLED_WHITE;
+    }
+    if(whitelisted_dirs.isEmpty()) {
+        return daemonError("Nothing to watch, please add folders");
+    }
+
+    if(!index_watcher) {
+        index_watcher.reset(new IndexWatcher(db_writer.get()));
+    }
+    if(!index_watcher->start(whitelisted_dirs, blacklisted_dirs, listed_exts, extension_filter_state)) {
+        index_watcher.reset();
+        return daemonError("Folders can't be watched on this system");
+    }
+    return {{"ok", true}, {"watched_dirs", index_watcher->watchedDirs()}};
+}
+
+QJsonArray MainWindow::duplicateGroupsJson() const {
+    QJsonArray groups;
+    // dedupe_resuts are rotated by location (see buildDedupeResults), entry i of every location is one group
+    for(const auto& multiFileGroup: dedupe_resuts) {
+        int group_count = multiFileGroup.isEmpty() ? 0 : multiFileGroup.first().size();
+        for(int i = 0; i < group_count; i++) {
+            QJsonArray paths;
+            for(const auto& location: multiFileGroup) {
+                if(i < location.size()) {
+                    paths.append(indexed_files.at(location.at(i)).full_path);
+                }
+            }
+            groups.append(paths);
+        }
+    }
+    return groups;
+}
+
+QJsonObject MainWindow::statsJson() const {
+    QJsonObject fields;
+    for(const auto& field: stat_results.meta_fields_stats) {
+        QJsonArray values;
+        for(const auto& value: field.second) {
+            values.append(QJsonObject{{"value", value.string}, {"count", (qint64)value.count}, {"total_size_bytes", value.total_size_bytes}});
+        }
+        fields[field.first] = values;
+    }
+    return {{"files", stat_results.total_files.num()}, {"bytes", (qint64)stat_results.total_files.size()}, {"fields", fields}};
+}
+
+#pragma endregion}
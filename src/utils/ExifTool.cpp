@@ -120,7 +120,8 @@ static double getTime()
 //         arg1 - optional first argument (ie. "exiftool" if exec="perl")
 ExifTool::ExifTool(const char *exec, const char *arg1)
         : mWatchdog(-1), mWriteInfo(NULL), mCmdQueue(NULL), mCmdQueueLen(0),
-          mCmdQueueSize(0), mLastComplete(0), mCmdNum(0), mWaitTime(1000)
+          mCmdQueueSize(0), mLastComplete(0), mCmdNum(0), mWaitTime(1000),
+          mTagPos(NULL)
 {
     int to[2], from[2], err[2];
     const char *args[7];
@@ -447,6 +448,164 @@ TagInfo *ExifTool::GetInfo(int cmdNum, double timeout)
     return infoList;
 }
 
+//------------------------------------------------------------------------------
+// Extract metadata from specified image without building a TagInfo list
+// Inputs:  file - source file name
+//          opts - string of exiftool options, separated by newlines
+//          timeout - maximum wait time (floating point seconds)
+// Returns: 1 if tags are ready to be read with NextTag(), 0 on timeout or
+//          no output, or <0 on error
+// - same as ImageInfo(), but avoids all memory allocations for the tags
+int ExifTool::ImageTags(const char *file, const char *opts, double timeout)
+{
+    int cmdNum = ExtractInfo(file, opts);
+
+    // error unless command number is > 0
+    if (cmdNum <= 0) return cmdNum ? cmdNum : -1;
+
+    return GetTags(cmdNum, timeout);
+}
+
+//------------------------------------------------------------------------------
+// Wait for exiftool output and prepare it for reading with NextTag()
+// Inputs:  cmdNum - command number (0 to process next output in series,
+//                      or -1 to process previously completed command)
+//          timeout - maximum wait time (floating point seconds)
+// Returns: 1 if tags are ready to be read, 0 on timeout or no output, or <0 on error
+// - don't mix with GetInfo() for the same response, both parse the buffer in place
+int ExifTool::GetTags(int cmdNum, double timeout)
+{
+    // wait for specified command to complete
+    if (cmdNum >= 0) {
+        for (;;) {
+            int n = Complete(timeout);
+            if (n <= 0) return n;
+            if (n == cmdNum || !cmdNum) break;
+        }
+    } else if (mLastComplete <= 0) {
+        return mLastComplete;
+    }
+    mTagPos = mStdout.GetString();
+    return mTagPos ? 1 : 0;
+}
+
+//------------------------------------------------------------------------------
+// Read the next tag of the response prepared by GetTags() or ImageTags()
+// Inputs:  tag - structure to fill in
+// Returns: 1 if a tag was read, 0 if there are no more tags
+// - tag strings point into the stdout buffer (which is modified in place),
+//   so they are only valid until the next command completes
+int ExifTool::NextTag(TagView *tag)
+{
+    if (!mTagPos || !tag) return 0;
+
+    memset(tag, 0, sizeof(TagView));
+
+    int mode = 0;   // 0=looking for tag name, 1=tag properties
+    char *pt = mTagPos;
+
+    for (;;) {
+        // find the end of this line
+        char *p0 = pt;
+        pt = strchr(pt, '\n');
+        if (!pt) break;
+        *pt = '\0'; // null terminate this line
+        ++pt;       // continue at next line
+        // scan for opening quote
+        p0 = strchr(p0, '"');
+        if (!p0) {
+            // no quote on line, so this must be the end of the tag info
+            if (mode) break;
+            continue;
+        }
+        char *p1 = ++p0;
+        if (!mode) {    // looking for new tag
+            // extract tag/group names (null terminated in place)
+            int g = 0;
+            for (;;) {
+                char ch = *p1;
+                if (!ch) break;     // (shouldn't happen)
+                if (ch == '"' || ch == ':') {
+                    int n = (int)(p1 - p0);
+                    *p1 = '\0';
+                    if (ch == '"') {
+                        tag->name = p0;     // save tag name
+                        tag->nameLen = n;
+                        break;
+                    }
+                    if (g > 2) {
+                        // get copy number
+                        if (!memcmp(p0, "Copy", 4)) tag->copyNum = atoi(p0+4);
+                    } else {
+                        tag->group[g] = p0; // save group name
+                        tag->groupLen[g] = n;
+                    }
+                    ++g;
+                    p0 = p1 + 1;
+                }
+                ++p1;
+            }
+            if (!tag->name) {
+                memset(tag, 0, sizeof(TagView));
+                continue;
+            }
+            // file name given by line like:  "SourceFile" => "images/a.jpg",
+            if (!strcmp(tag->name,"SourceFile")) {
+                char *p2 = pt - 2;
+                if (*p2 == '\r') --p2; // skip Windows CR
+                if (*p2 == ',') --p2;
+                int n = (int)(p2 - p1 - 6);
+                if (*p2 != '"' || n < 0) {
+                    memset(tag, 0, sizeof(TagView));
+                    continue;
+                }
+                *p2 = '\0';
+                tag->value = tag->num = p1 + 6;
+                tag->valueLen = tag->numLen = n;
+                mTagPos = pt;
+                return 1;
+            }
+            mode = 1;   // read tag properties next
+        } else {
+            // isolate the property name
+            p1 = strchr(p0, '"');
+            if (!p1) { pt = NULL; break; }          // (shouldn't happen)
+            *p1 = '\0';             // null terminate property name
+            p1 += 5;                // step to start of value
+            if (p1 >= pt) { pt = NULL; break; }     // (shouldn't happen)
+            if (*p1 == '"') ++p1;   // skip quote if it exists
+            char *p2 = pt - 1;
+            if (p2[-1] == '\r') --p2;// skip Windows CR
+            if (p2[-1] == ',') --p2;// skip trailing comma
+            if (p2[-1] == '"') --p2;// skip trailing quote
+            if (p2 < p1) { pt = NULL; break; }      // (shouldn't happen)
+            *p2 = '\0';             // null terminate property value
+            int n = unescape(p1);   // unescape characters in property value
+            if (!strcmp(p0, "desc")) {
+                tag->desc = p1;
+            } else if (!strcmp(p0, "id")) {
+                tag->id = p1;
+            } else if (!strcmp(p0, "num")) {
+                tag->num = p1;
+                tag->numLen = n - 1;    // save length too (could be binary data)
+            } else if (!strcmp(p0, "val")) {
+                tag->value = p1;
+                tag->valueLen = n - 1;  // save length too (could be binary data)
+            }
+        }
+    }
+    mTagPos = pt;
+    if (!mode) return 0;
+
+    // fill in necessary members of this tag (name and value are guaranteed to exist)
+    if (!tag->value) tag->value = "";
+    if (!tag->num) {
+        tag->num = tag->value;
+        tag->numLen = tag->valueLen;
+    }
+    return 1;
+}
+
 //------------------------------------------------------------------------------
 // Set the new value for a tag
 // Inputs:  tag = tag name (may contain leading group names and trailing '#')
@@ -714,6 +873,7 @@ int ExifTool::Command(const char *cmd)
 int ExifTool::Complete(double timeout)
 {
     if (mCmdQueue) Command();       // try to send queued commands (if any)
+    mTagPos = NULL;                 // (stdout buffer is about to be reused)
     double doneTime = getTime() + timeout;
     int cmdNum;
     for (;;) {
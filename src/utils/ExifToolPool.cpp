@@ -0,0 +1,161 @@
+#include "ExifToolPool.h"
+
+#include <QDebug>
+
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <signal.h>
+#include <sys/wait.h>
+
+// max number of workers the supervisor can keep track of
+const int kMaxSupervisedWorkers = 1024;
+
+ExifToolPool::ExifToolPool(int max_workers, int idle_timeout_ms)
+    : max_workers(qMax(max_workers, 1)), idle_timeout_ms(idle_timeout_ms) {
+    // the pool supervises all workers itself
+    ExifTool::sNoWatchdog = 1;
+    clock.start();
+}
+
+ExifToolPool::~ExifToolPool() {
+    QMutexLocker lock(&mutex);
+    for(auto& worker: idle_workers) {
+        stopWorker(worker.ex_tool);
+        running_workers --;
+    }
+    idle_workers.clear();
+    // the rest are still leased, their owners outlived the pool
+    if(running_workers > 0) {
+        qWarning() << running_workers << "exiftool worker(s) were not returned to the pool";
+    }
+    if(supervisor_pid > 0) {
+        // closing the pipe tells the supervisor to exit
+        close(supervisor_pipe);
+        waitpid(supervisor_pid, nullptr, 0);
+    }
+}
+
+ExifTool* ExifToolPool::acquire() {
+    QMutexLocker lock(&mutex);
+    while(idle_workers.isEmpty()) {
+        if(running_workers < max_workers) {
+            // all workers are busy, grow the pool
+            if(supervisor_pid == -1) {
+                startSupervisor();
+            }
+            running_workers ++;
+            lock.unlock();
+            ExifTool* ex_tool = new ExifTool();
+            notifySupervisor(ex_tool->GetPid());
+            qDebug() << "Started exiftool worker" << ex_tool->GetPid();
+            return ex_tool;
+        }
+        worker_released.wait(&mutex);
+    }
+    // reuse the most recently released worker so that the rest can time out
+    return idle_workers.takeLast().ex_tool;
+}
+
+void ExifToolPool::release(ExifTool* ex_tool) {
+    QMutexLocker lock(&mutex);
+    idle_workers.append({ex_tool, clock.elapsed()});
+    worker_released.wakeOne();
+}
+
+void ExifToolPool::shrinkIdle() {
+    QVector<ExifTool*> expired;
+    {
+        QMutexLocker lock(&mutex);
+        qint64 now = clock.elapsed();
+        // idle_workers is ordered by release time, oldest first
+        while(!idle_workers.isEmpty() && now - idle_workers.first().idle_since > idle_timeout_ms) {
+            expired.append(idle_workers.takeFirst().ex_tool);
+            running_workers --;
+        }
+    }
+    for(auto ex_tool: expired) {
+        qDebug() << "Stopping idle exiftool worker" << ex_tool->GetPid();
+        stopWorker(ex_tool);
+    }
+}
+
+int ExifToolPool::runningWorkers() {
+    QMutexLocker lock(&mutex);
+    return running_workers;
+}
+
+void ExifToolPool::stopWorker(ExifTool* ex_tool) {
+    int pid = ex_tool->GetPid();
+    delete ex_tool;
+    if(pid > 0) {
+        notifySupervisor(-pid);
+    }
+}
+
+void ExifToolPool::notifySupervisor(int pid) {
+    if(supervisor_pipe == -1 || pid == 0 || pid == -1) {
+        return;
+    }
+    qint32 msg = pid;
+    // messages are smaller than PIPE_BUF so writes are atomic
+    if(write(supervisor_pipe, &msg, sizeof(msg)) != sizeof(msg)) {
+        qWarning() << "Failed notifying exiftool supervisor:" << strerror(errno);
+    }
+}
+
+void ExifToolPool::startSupervisor() {
+    int fds[2];
+    // close-on-exec so that exiftool processes don't keep the pipe open
+    if(pipe2(fds, O_CLOEXEC) != 0) {
+        qWarning() << "Failed creating exiftool supervisor pipe:" << strerror(errno);
+        supervisor_pid = 0;
+        return;
+    }
+
+    int pid = fork();
+    if(pid == 0) {
+        // supervisor process, only async-signal-safe calls from here on
+        close(fds[1]);
+        int pids[kMaxSupervisedWorkers];
+        int num_pids = 0;
+        for(;;) {
+            qint32 msg;
+            ssize_t n = read(fds[0], &msg, sizeof(msg));
+            if(n < 0 && errno == EINTR) {
+                continue;
+            }
+            if(n != sizeof(msg)) {
+                // the write end was closed, our parent is gone (or the pool was destroyed)
+                for(int i = 0; i < num_pids; i++) {
+                    kill(pids[i], SIGINT);
+                }
+                _exit(0);
+            }
+            if(msg > 0) {
+                if(num_pids < kMaxSupervisedWorkers) {
+                    pids[num_pids++] = msg;
+                }
+            } else {
+                for(int i = 0; i < num_pids; i++) {
+                    if(pids[i] == -msg) {
+                        pids[i] = pids[--num_pids];
+                        break;
+                    }
+                }
+            }
+        }
+    }
+
+    close(fds[0]);
+    if(pid < 0) {
+        qWarning() << "Failed starting exiftool supervisor:" << strerror(errno);
+        close(fds[1]);
+        supervisor_pid = 0;
+        return;
+    }
+    supervisor_pipe = fds[1];
+    supervisor_pid = pid;
+    qDebug() << "Started exiftool supervisor" << supervisor_pid;
+}
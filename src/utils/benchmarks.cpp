@@ -0,0 +1,195 @@
+#include "benchmarks.h"
+#include "gutils.h"
+#include "file_table.h"
+#include "flat_group_map.h"
+#include "sort_grouping.h"
+#include "db_writer.h"
+
+#include <QTextStream>
+#include <QTemporaryDir>
+#include <QElapsedTimer>
+#include <QRandomGenerator>
+#include <QFileInfo>
+#include <QSqlQuery>
+
+#include <functional>
+
+namespace {
+
+QTextStream& out() {
+    static QTextStream stream(stdout);
+    return stream;
+}
+
+#pragma region Db benchmark {
+
+const int kDbFiles = 200000;
+// same batch size as DbWriter
+const int kDbBatchSize = 512;
+
+QString benchmarkDir(int i) {
+    return QString("/media/photos/%1/%2").arg(2000 + i % 20).arg(i % 12 + 1);
+}
+
+QString benchmarkName(int i) {
+    return QString("IMG_%1.JPG").arg(i, 7, 10, QChar('0'));
+}
+
+// the current index layout (DbSchema) written and read the way a scan does it
+void benchmarkDbConfig(const QString& name, const DbUtils::StorageConfig& config) {
+    QTemporaryDir dir;
+    QString db_path = dir.filePath("benchmark.db");
+    QElapsedTimer timer;
+
+    // hash records through the db writer, batched like during a scan
+    timer.start();
+    {
+        DbWriter writer(db_path, kDbBatchSize, config);
+        QByteArray hash(32, '\0');
+        for(int i = 0; i < kDbFiles; i++) {
+            for(auto& byte: hash) {
+                byte = (char)QRandomGenerator::global()->generate();
+            }
+            auto record = new DbWriter::Record;
+            record->type = DbWriter::Record::HASH;
+            record->dir = benchmarkDir(i);
+            record->name = benchmarkName(i);
+            record->size_bytes = i * 1024;
+            record->mtime_ms = i;
+            record->inode = i;
+            record->hash = hash;
+            record->partial_hash = hash.left(16);
+            writer.push(record);
+        }
+        writer.flush();
+    }
+    qint64 insert_ms = timer.restart();
+
+    {
+        QSqlDatabase db = DbUtils::openDbConnection("benchmark_" + name, db_path, config);
+
+        // random point lookups, same statement as File::loadHashFromDb on a rescan
+        QSqlQuery select_query(db);
+        select_query.prepare("SELECT t.hash, t.partial_hash, t.perceptual_hash FROM directories d JOIN files f ON f.dir_id = d.id "
+                             "JOIN hashes t ON t.file_id = f.id WHERE d.path = ? AND f.name = ? AND f.size = ? AND (f.mtime IS NULL OR f.mtime = ?)");
+        int found = 0;
+        for(int i = 0; i < kDbFiles; i++) {
+            int file = QRandomGenerator::global()->bounded(kDbFiles);
+            select_query.bindValue(0, benchmarkDir(file));
+            select_query.bindValue(1, benchmarkName(file));
+            select_query.bindValue(2, file * 1024);
+            select_query.bindValue(3, file);
+            select_query.exec();
+            found += select_query.first();
+        }
+        qint64 select_ms = timer.elapsed();
+
+        out() << QString("%1: %2 records through the db writer %3 ms, %4 lookups %5 ms (%6 found), db size %7")
+                 .arg(name).arg(kDbFiles).arg(insert_ms).arg(kDbFiles).arg(select_ms).arg(found)
+                 .arg(FileUtils::bytesToReadable(QFileInfo(db_path).size() + QFileInfo(db_path + "-wal").size()))
+              << Qt::endl;
+        db.close();
+    }
+    QSqlDatabase::removeDatabase("benchmark_" + name);
+}
+
+void benchmarkDb() {
+    // what sqlite does without any pragmas
+    DbUtils::StorageConfig sqlite_defaults;
+    sqlite_defaults.wal = false;
+    sqlite_defaults.synchronous_normal = false;
+    sqlite_defaults.cache_size_kib = 2000;
+    sqlite_defaults.mmap_size_bytes = 0;
+    sqlite_defaults.temp_store_memory = false;
+
+    benchmarkDbConfig("sqlite_defaults", sqlite_defaults);
+    benchmarkDbConfig("index_storage_config", DbUtils::StorageConfig());
+}
+
+#pragma endregion}
+
+#pragma region Grouping benchmark {
+
+const int kGroupingFiles = 2000000;
+// every n-th file is a copy of an earlier one
+const int kGroupingDuplicateEvery = 4;
+
+// grouping by full hash, the way findDuplicateFiles did it (QMap, QByteArray keys) and the two current backends
+void benchmarkGrouping() {
+    QVector<Digest> hashes(kGroupingFiles);
+    for(int i = 0; i < kGroupingFiles; i++) {
+        if(i > 0 && i % kGroupingDuplicateEvery == 0) {
+            hashes[i] = hashes[QRandomGenerator::global()->bounded(i)];
+        } else {
+            QRandomGenerator::global()->fillRange((quint32*)hashes[i].data(), digest_size / sizeof(quint32));
+        }
+    }
+
+    QElapsedTimer timer;
+    timer.start();
+    int qmap_groups = 0;
+    {
+        QMap<QByteArray, QVector<quint32>> groups;
+        for(int i = 0; i < kGroupingFiles; i++) {
+            groups[QByteArray((const char*)hashes[i].data(), digest_size)].append(i);
+        }
+        for(auto& group: groups) {
+            qmap_groups += group.size() > 1;
+        }
+    }
+    qint64 qmap_ms = timer.restart();
+
+    int flat_groups = 0;
+    {
+        FlatGroupMap<Digest, QVector<quint32>> groups(kGroupingFiles);
+        for(int i = 0; i < kGroupingFiles; i++) {
+            groups[hashes[i]].append(i);
+        }
+        for(auto& group: groups.allValues()) {
+            flat_groups += group.size() > 1;
+        }
+    }
+    qint64 flat_ms = timer.restart();
+
+    int sort_groups = 0;
+    {
+        QVector<SortGrouping::Record> records(kGroupingFiles);
+        for(int i = 0; i < kGroupingFiles; i++) {
+            // same size for all, so only the digests tell files apart
+            records[i] = {SortGrouping::keyOf(hashes[i]), 0, (quint32)i};
+        }
+        sort_groups = SortGrouping::findGroups(records, [&hashes](quint32 a, quint32 b) {
+            return hashes[a] == hashes[b];
+        }).size();
+    }
+    qint64 sort_ms = timer.elapsed();
+
+    out() << QString("%1 hashes: QMap<QByteArray> %2 ms (%3 duplicate groups), FlatGroupMap<Digest> %4 ms (%5 duplicate groups), "
+                     "radix sort %6 ms (%7 duplicate groups)")
+             .arg(kGroupingFiles).arg(qmap_ms).arg(qmap_groups).arg(flat_ms).arg(flat_groups).arg(sort_ms).arg(sort_groups)
+          << Qt::endl;
+}
+
+#pragma endregion}
+
+const QList<QPair<QString, std::function<void()>>> benchmarks = {
+    {"db", benchmarkDb},
+    {"grouping", benchmarkGrouping}
+};
+
+}
+
+int Benchmarks::run(const QString& name) {
+    for(auto& [benchmark_name, benchmark]: benchmarks) {
+        if(benchmark_name == name) {
+            benchmark();
+            return 0;
+        }
+    }
+    QStringList names;
+    for(auto& benchmark: benchmarks) {
+        names.append(benchmark.first);
+    }
+    out() << QString("Unknown benchmark \"%1\", available: %2").arg(name, names.join(", ")) << Qt::endl;
+    return 1;
+}
@@ -1,6 +1,9 @@
 #include "datatypes.h"
 #include "gutils.h"
 #include "meta_converters.h"
+#include "native_metadata.h"
+#include "db_writer.h"
+#include "db_connection_pool.h"
 
 
 #include <QApplication>
@@ -16,6 +19,9 @@
 
 #include <QtConcurrent/QtConcurrent>
 
+#include <cstring>
+#include <sys/stat.h>
+
 const QVector<QString> empty_values = {"", "-", "--", "0000:00:00 00:00:00", "0000:00:00", "00:00:00"};
 
 const QMap<QString, QPair<QStringList, std::function<void(QString&, QString)>>> metadataMap_name_to_fields =
@@ -48,14 +54,129 @@ const QMap<QString, QPair<QStringList, std::function<void(QString&, QString)>>>
                       "Track Duration"}, durationConverter}}
 };
 
-// user-defined maps to remap any xmp value
+const QStringList metaFieldsList = metadataMap_name_to_fields.keys();
+
+// user-defined maps to remap any xmp value (per field slot)
 // for instance E5823 to some meaningfull camera name
-QMap<QString, QMap<QString, QString>> metaMaps;
+std::array<QHash<QString, QString>, meta_fields_count> metaMaps;
 bool metaMapsLoaded = false;
 
-// procedurally generated
-QStringList needed_exif_fields;
-const QStringList metaFieldsList = metadataMap_name_to_fields.keys();
+// exiftool tag -> field slot lookup, compiled once from metadataMap_name_to_fields
+// flat open addressing table, so matching a tag needs neither a QString nor a tree walk
+class ExifTagLookup {
+
+public:
+
+    struct Entry {
+        QByteArray tag;
+        int field = -1;
+        // position in the field's tag list, later tags take precedence
+        int priority = -1;
+    };
+
+    ExifTagLookup() {
+        Q_ASSERT(metaFieldsList.size() == meta_fields_count);
+
+        int tags_count = 0;
+        for(auto& field_tags: metadataMap_name_to_fields) {
+            tags_count += field_tags.first.size();
+        }
+
+        // keep the load factor low so that most lookups hit on the first probe
+        int capacity = 16;
+        while(capacity < tags_count * 4) {
+            capacity <<= 1;
+        }
+        entries.resize(capacity);
+        mask = capacity - 1;
+
+        for(int field = 0; field < meta_fields_count; field++) {
+            const auto& field_tags = metadataMap_name_to_fields.value(metaFieldsList.at(field));
+            const QStringList& tags = field_tags.first;
+            converters[field] = field_tags.second;
+            for(int priority = 0; priority < tags.size(); priority++) {
+                QByteArray tag = tags.at(priority).toUtf8();
+                quint32 i = hash(tag.constData(), tag.size()) & mask;
+                while(!entries[i].tag.isEmpty() && entries[i].tag != tag) {
+                    i = (i + 1) & mask;
+                }
+                if(!entries[i].tag.isEmpty()) {
+                    qWarning() << "Duplicate exif field for metadata field: " << tag;
+                    continue;
+                }
+                entries[i] = {tag, field, priority};
+            }
+        }
+
+        creation_date_field = metaFieldsList.indexOf("Creation date");
+    }
+
+    const Entry* find(const char* tag, int len) const {
+        quint32 i = hash(tag, len) & mask;
+        while(!entries[i].tag.isEmpty()) {
+            const Entry& entry = entries[i];
+            if(entry.tag.size() == len && memcmp(entry.tag.constData(), tag, len) == 0) {
+                return &entry;
+            }
+            i = (i + 1) & mask;
+        }
+        return nullptr;
+    }
+
+    std::array<std::function<void(QString&, QString)>, meta_fields_count> converters;
+    int creation_date_field;
+
+private:
+
+    QVector<Entry> entries;
+    quint32 mask;
+
+    // FNV-1a
+    static quint32 hash(const char* data, int len) {
+        quint32 h = 2166136261u;
+        for(int i = 0; i < len; i++) {
+            h ^= static_cast<quint8>(data[i]);
+            h *= 16777619u;
+        }
+        return h;
+    }
+};
+
+const ExifTagLookup exif_tag_lookup;
+
+// keeps the value of the highest priority tag for every field slot
+struct ExifTagCollector {
+
+    MetaFieldValues values;
+    std::array<int, meta_fields_count> priorities;
+
+    ExifTagCollector() {
+        priorities.fill(-1);
+    }
+
+    void add(const char* tag, int tag_len, const char* value, int value_len) {
+        const ExifTagLookup::Entry* entry = exif_tag_lookup.find(tag, tag_len);
+        if(entry && entry->priority >= priorities[entry->field]) {
+            QString value_str = QString::fromUtf8(value, value_len);
+            if(!empty_values.contains(value_str)) {
+                values[entry->field] = value_str;
+                priorities[entry->field] = entry->priority;
+            }
+        }
+    }
+};
+
+File::File(const QString& full_path, qint64 size_bytes, qint64 mtime_ms)
+    : File(QFileInfo(full_path).path(), QFileInfo(full_path).fileName(), size_bytes, mtime_ms) {
+}
+
+File::File(const QString& dir, const QString& name, qint64 size_bytes, qint64 mtime_ms)
+    : path_without_name(dir), name(name), size_bytes(size_bytes), mtime_ms(mtime_ms) {
+    // same as QFileInfo::completeSuffix, without touching the filesystem
+    int first_dot = name.indexOf('.');
+    extension = first_dot >= 0 ? name.mid(first_dot + 1).toLower() : QString();
+    full_path = dir.endsWith('/') ? dir + name : dir + '/' + name;
+}
 
 void File::updateMetadata(const QFile &qfile) {
 
@@ -66,8 +187,12 @@ void File::updateMetadata(const QFile &qfile) {
     name = info.fileName();
     extension = info.completeSuffix().toLower();
     size_bytes = qfile.size();
+    mtime_ms = info.lastModified().toMSecsSinceEpoch();
 
-    metadata["extension"] = extension;
+    struct stat st;
+    bool stated = stat(QFile::encodeName(info.absoluteFilePath()).constData(), &st) == 0;
+    inode = stated ? st.st_ino : 0;
+    device = stated ? st.st_dev : 0;
 }
 
 bool File::rename(const QString &new_name) {
@@ -90,7 +215,8 @@ void File::loadStatisMetaMaps() {
         QFileInfoList config_files = QDir("./config").entryInfoList(QDir::Filter::Files);
         for(auto& config_file: config_files) {
             QString fileName = config_file.fileName();
-            if(!metadataMap_name_to_fields.contains(fileName)) {
+            int field = getMetaFieldIndex(fileName);
+            if(field == -1) {
                 qWarning() << "Unknown config file:" << fileName;
             } else {
                 QFile file(config_file.absoluteFilePath());
@@ -103,10 +229,10 @@ void File::loadStatisMetaMaps() {
                           qWarning() << "Invalid config file line:" << line;
                       } else {
                           QString key = mapPair[0].trimmed();
-                          if(metaMaps[fileName].contains(key)) {
+                          if(metaMaps[field].contains(key)) {
                                qWarning() << "Duplicate key in config file:" << fileName << "key:" << key;
                           } else {
-                               metaMaps[fileName].insert(key, mapPair[1].trimmed());
+                               metaMaps[field].insert(key, mapPair[1].trimmed());
                           }
                       }
                    }
@@ -115,108 +241,109 @@ void File::loadStatisMetaMaps() {
             }
         }
     }
-
-    // construct lookup table if it doesn't exist
-    if (needed_exif_fields.isEmpty()) {
-        qDebug() << "needed_exif_fields constructed";
-        for (auto& key: metaFieldsList) {
-            for (auto& exif_field: metadataMap_name_to_fields[key].first) {
-                if(!needed_exif_fields.contains(exif_field)) {
-                    needed_exif_fields.append(exif_field);
-                } else {
-                    qWarning() << "Duplicate exif field for metadata field: " << exif_field;
-                }
-            }
-        }
-    }
 }
 
 void File::loadMetadataFromExifTool(ExifTool* ex_tool, const QString& datetime_format) {
 
     // get known values
-    QMap<QString, QString> gathered_values;
-
-    TagInfo *info = ex_tool->ImageInfo(full_path.toStdString().c_str(), Constants::datetime_format_exiftool);
-    if (info) {
-        for (TagInfo *i = info; i; i = i->next) {
-            QString name = QString::fromUtf8(i->name);
-            QString value = QString::fromUtf8(i->value);
-            if(needed_exif_fields.contains(name) && !empty_values.contains(value)) {
-                gathered_values.insert(name, value);
-            }
+    ExifTagCollector gathered_values;
+
+    // tags are read straight from the exiftool output buffer, strings are only created for needed tags
+    if (ex_tool->ImageTags(full_path.toStdString().c_str(), Constants::datetime_format_exiftool) > 0) {
+        TagView tag;
+        while (ex_tool->NextTag(&tag)) {
+            gathered_values.add(tag.name, tag.nameLen, tag.value, tag.valueLen);
         }
-        delete info;
     } else if (ex_tool->LastComplete() <= 0) {
         qCritical() << "Error executing exiftool on " + full_path;
     }
 
-    for(auto& out_field: metaFieldsList) {
-        // iterate through all suitable fields
-        for(auto& exif_field: metadataMap_name_to_fields[out_field].first) {
-            // check if if was returned by exiftool and is not considered empty
-            if(gathered_values.contains(exif_field)) {
-
-                QString value = gathered_values[exif_field].trimmed();
-                // use converter if provided
-                if(metadataMap_name_to_fields[out_field].second) {
-                    QString parameter;
-                    if(out_field == "Creation date") {
-                        parameter = datetime_format;
-                    }
-                    metadataMap_name_to_fields[out_field].second(value, parameter);
-                }
-                metadata.insert(out_field, remapMetaValue(out_field, value));
-            }
-        }
-        // no suitable field was found
-        if (!metadata.contains(out_field)) {
-            qDebug() << "Could not get" << out_field << "for" << full_path;
-            metadata.insert(out_field, "");
-        }
-    }
+    applyGatheredMetadata(gathered_values.values, datetime_format);
 
     char *err = ex_tool->GetError();
     if (err) qWarning() << err;
 }
 
-QString File::remapMetaValue(const QString& field, const QString& value) {
-    if(metaMaps.contains(field) && metaMaps.value(field).contains(value)) {
-        qDebug() << "Mapped" << value << "to" << metaMaps[field][value];
-        return metaMaps[field][value];
+bool File::loadMetadataNative(const QString& datetime_format) {
+    QMap<QString, QString> tags;
+    if(!NativeMetadata::readTags(full_path, tags)) {
+        return false;
+    }
+
+    ExifTagCollector gathered_values;
+    for(auto it = tags.cbegin(); it != tags.cend(); it++) {
+        QByteArray tag = it.key().toUtf8();
+        QByteArray value = it.value().toUtf8();
+        gathered_values.add(tag.constData(), tag.size(), value.constData(), value.size());
+    }
+
+    applyGatheredMetadata(gathered_values.values, datetime_format);
+    return true;
+}
+
+void File::applyGatheredMetadata(const MetaFieldValues& gathered_values, const QString& datetime_format) {
+    for(int field = 0; field < meta_fields_count; field++) {
+        // no suitable field was found
+        if(gathered_values[field].isNull()) {
+            qDebug() << "Could not get" << metaFieldsList.at(field) << "for" << full_path;
+            metadata[field] = "";
+            continue;
+        }
+
+        QString value = gathered_values[field].trimmed();
+        // use converter if provided
+        if(exif_tag_lookup.converters[field]) {
+            QString parameter;
+            if(field == exif_tag_lookup.creation_date_field) {
+                parameter = datetime_format;
+            }
+            exif_tag_lookup.converters[field](value, parameter);
+        }
+        metadata[field] = remapMetaValue(field, value);
+    }
+}
+
+QString File::remapMetaValue(int field, const QString& value) {
+    auto mapped = metaMaps[field].constFind(value);
+    if(mapped != metaMaps[field].constEnd()) {
+        qDebug() << "Mapped" << value << "to" << mapped.value();
+        return mapped.value();
     }
     return value;
 }
 
-QFuture<void> File::loadHash(QSqlDatabase db, HashType hash_type) {
-    if(loadHashFromDb(db, hash_type)) {
-        QFuture<void> future;
-        future.cancel();
-        return future;
+bool File::loadHashBlocking(HashType hash_type) {
+    // offline files only have what their catalog stored
+    if(offline || loadHashFromDb(DbConnectionPool::reader(), hash_type)) {
+        return false;
+    }
+    switch (hash_type) {
+        case FULL:
+            hash = FileUtils::getFileHash(full_path);
+            break;
+        case PARTIAL:
+            partial_hash = FileUtils::getPartialFileHash(full_path);
+            break;
+        case PERCEPTUAL:
+            perceptual_hash = FileUtils::getPerceptualImageHash(full_path);
+            break;
     }
+    return true;
+}
+
+QFuture<bool> File::loadHash(HashType hash_type) {
     return QtConcurrent::run([hash_type, this]() {
-        switch (hash_type) {
-            case FULL:
-                hash = FileUtils::getFileHash(full_path);
-                break;
-            case PARTIAL:
-                partial_hash = FileUtils::getPartialFileHash(full_path);
-                break;
-            case PERCEPTUAL:
-                perceptual_hash = FileUtils::getPerceptualImageHash(full_path);
-                break;
-        }
+        return loadHashBlocking(hash_type);
     });
 }
 
 QMimeDatabase mime_database;
 
-QFuture<void> File::loadThumbnail(QSqlDatabase db) {
-    if(loadThumbnailFromDb(db)) {
-        QFuture<void> future;
-        future.cancel();
-        return future;
-    }
+QFuture<bool> File::loadThumbnail() {
     return QtConcurrent::run([this]() {
+        if(offline || loadThumbnailFromDb(DbConnectionPool::reader())) {
+            return false;
+        }
         // try to get thumbnail directly from file
         thumbnail = QIcon(full_path).pixmap(200, 200);
 
@@ -224,6 +351,7 @@ QFuture<void> File::loadThumbnail(QSqlDatabase db) {
             thumbnail = FileUtils::generateThumbnail(full_path, 200);
         }
         // continue in the main thread
+        return true;
     });
 }
 
@@ -246,129 +374,128 @@ void File::postLoadThumbnail() {
     }
 }
 
-void File::saveThumbnailToDb(QSqlDatabase db) {
-    QString insertionString = QString("INSERT OR REPLACE INTO thumbnails (full_path, size, thumbnail) "
-                                      "VALUES(:full_path, :size, :thumbnail)");
-
-    QSqlQuery query(db);
-    query.prepare(insertionString);
-
-    query.bindValue(":full_path", full_path);
-    query.bindValue(":size", size_bytes);
+// identifies the files row a record belongs to
+static void setRecordFile(DbWriter::Record* record, const File& file) {
+    record->dir = file.path_without_name;
+    record->dir_id = file.dir_id;
+    record->name = file.name;
+    record->size_bytes = file.size_bytes;
+    record->mtime_ms = file.mtime_ms;
+    record->inode = file.inode;
+}
 
-    QByteArray thumbnail_raw;
-    QBuffer inBuffer( &thumbnail_raw );
-    inBuffer.open( QIODevice::WriteOnly );
-    thumbnail.save( &inBuffer, "PNG" );
+void File::saveThumbnailToDb(DbWriter* db_writer) {
+    auto record = new DbWriter::Record;
+    record->type = DbWriter::Record::THUMBNAIL;
+    setRecordFile(record, *this);
 
-    query.bindValue(":thumbnail", thumbnail_raw);
+    {
+        QBuffer inBuffer( &record->thumbnail );
+        inBuffer.open( QIODevice::WriteOnly );
+        thumbnail.save( &inBuffer, "PNG" );
+    }
 
-    DbUtils::execQuery(query);
+    db_writer->push(record);
 }
 
-void File::saveHashToDb(QSqlDatabase db) {
-    QString insertionString = "INSERT OR REPLACE INTO hashes (full_path, size, hash, partial_hash, perceptual_hash) "
-                              "VALUES(:full_path, :size, :hash, :partial_hash, :perceptual_hash)";
-    QSqlQuery query(db);
-    query.prepare(insertionString);
-
-    query.bindValue(":full_path", full_path);
-    query.bindValue(":size", size_bytes);
-    query.bindValue(":hash", hash);
-    query.bindValue(":partial_hash", partial_hash);
-    query.bindValue(":perceptual_hash", perceptual_hash);
+void File::saveHashToDb(DbWriter* db_writer) {
+    auto record = new DbWriter::Record;
+    record->type = DbWriter::Record::HASH;
+    setRecordFile(record, *this);
+    record->hash = hash;
+    record->partial_hash = partial_hash;
+    record->perceptual_hash = perceptual_hash;
 
-    DbUtils::execQuery(query);
+    db_writer->push(record);
 }
 
-void File::saveMetadataToDb(QSqlDatabase db) {
+void File::saveMetadataToDb(DbWriter* db_writer) {
+    auto record = new DbWriter::Record;
+    record->type = DbWriter::Record::METADATA;
+    setRecordFile(record, *this);
+    record->metadata = metadata;
 
-    QString columns;
-    QString values;
-    QStringList metaFieldsForDb = metaFieldsList;
-    for(auto& meta_field: metaFieldsForDb) {
-        meta_field.replace(" ", "_");
-        columns += "," + meta_field;
-        values += ", :" + meta_field;
-        meta_field = ":" + meta_field;
-    }
+    db_writer->push(record);
+}
 
-    QString insertionString = QString("INSERT OR REPLACE INTO metadata (full_path, size%1) "
-                                      "VALUES(:full_path, :size%2)")
-            .arg(columns, values);
+void File::removeFromDb(DbWriter* db_writer) {
+    auto record = new DbWriter::Record;
+    record->type = DbWriter::Record::REMOVE;
+    setRecordFile(record, *this);
 
-    QSqlQuery query(db);
-    query.prepare(insertionString);
+    db_writer->push(record);
+}
 
-    query.bindValue(":full_path", full_path);
-    query.bindValue(":size", size_bytes);
+CacheHitCounter File::hash_cache;
+CacheHitCounter File::metadata_cache;
+CacheHitCounter File::thumbnail_cache;
 
-    for(int i = 0; i < metaFieldsList.length(); i++) {
-        query.bindValue(metaFieldsForDb.at(i), metadata[metaFieldsList.at(i)]);
-    }
+// select columns of table for this file, only if the cached file entry is still up to date
+bool File::selectCachedData(QSqlQuery& query, const QString& table, const QString& columns) {
+    query.prepare(QString("SELECT %1 FROM directories d JOIN files f ON f.dir_id = d.id JOIN %2 t ON t.file_id = f.id "
+                          "WHERE d.path = ? AND f.name = ? AND f.size = ? AND (f.mtime IS NULL OR f.mtime = ?)")
+                  .arg(columns, table));
+    query.bindValue(0, path_without_name);
+    query.bindValue(1, name);
+    query.bindValue(2, size_bytes);
+    query.bindValue(3, mtime_ms);
 
     DbUtils::execQuery(query);
+
+    return query.first();
 }
 
 // load metadata from database if present, return true if loading succeeded
 bool File::loadMetadataFromDb(QSqlDatabase db) {
 
-    QString columns;
+    QStringList columns;
     for(auto meta_field: metaFieldsList) {
-        columns += "," + meta_field.replace(" ", "_");
+        columns.append("t." + meta_field.replace(" ", "_"));
     }
 
     QSqlQuery query(db);
-    query.prepare(QString("SELECT full_path, size %1 FROM metadata WHERE full_path = ?").arg(columns));
-    query.bindValue(0, full_path);
-
-    DbUtils::execQuery(query);
-
-    if(query.first() && query.value(1) == size_bytes) {
-        for(int i = 0; i < metaFieldsList.size(); i++) {
-            metadata.insert(metaFieldsList.at(i), remapMetaValue(metaFieldsList.at(i), query.value(i + 2).toString()));
+    bool cached = selectCachedData(query, "metadata", columns.join(", "));
+    metadata_cache.count(cached);
+    if(cached) {
+        for(int i = 0; i < meta_fields_count; i++) {
+            metadata[i] = remapMetaValue(i, query.value(i).toString());
         }
-        return true;
     }
-    return false;
+    return cached;
 }
 
 // load hash from database if present, return true if loading succeeded
 bool File::loadHashFromDb(QSqlDatabase db, HashType hash_type) {
     QSqlQuery query(db);
-    query.prepare("SELECT full_path, size, hash, partial_hash, perceptual_hash FROM hashes WHERE full_path = ?");
-    query.bindValue(0, full_path);
-
-    DbUtils::execQuery(query);
-
-    if(query.first() && query.value(1) == size_bytes) {
-        hash = query.value(2).toByteArray();
-        partial_hash = query.value(3).toByteArray();
-        perceptual_hash = query.value(4).toByteArray();
+    bool cached = false;
+    if(selectCachedData(query, "hashes", "t.hash, t.partial_hash, t.perceptual_hash")) {
+        hash = query.value(0).toByteArray();
+        partial_hash = query.value(1).toByteArray();
+        perceptual_hash = query.value(2).toByteArray();
         switch (hash_type) {
             case FULL:
-                return !hash.isEmpty();
+                cached = !hash.isEmpty();
+                break;
             case PARTIAL:
-                return !partial_hash.isEmpty();
+                cached = !partial_hash.isEmpty();
+                break;
             case PERCEPTUAL:
-                return !perceptual_hash.isEmpty();
+                cached = !perceptual_hash.isEmpty();
+                break;
         }
     }
-    return false;
+    hash_cache.count(cached);
+    return cached;
 }
 
 bool File::loadThumbnailFromDb(QSqlDatabase db) {
     QSqlQuery query(db);
-    query.prepare(QString("SELECT full_path, size, thumbnail FROM thumbnails WHERE full_path = ?"));
-    query.bindValue(0, full_path);
-
-    DbUtils::execQuery(query);
-
-    if(query.first() && query.value(1) == size_bytes) {
-        thumbnail.loadFromData(query.value(2).toByteArray());
-        return true;
+    bool cached = selectCachedData(query, "thumbnails", "t.thumbnail");
+    thumbnail_cache.count(cached);
+    if(cached) {
+        thumbnail.loadFromData(query.value(0).toByteArray());
     }
-    return false;
+    return cached;
 }
 
 QString FileQuantitySizeCounter::size_readable() const {
@@ -383,6 +510,10 @@ QList<QString> getMetaFieldsList() {
     return metaFieldsList;
 }
 
+int getMetaFieldIndex(const QString& field) {
+    return metaFieldsList.indexOf(field);
+}
+
 ExifFormat::ExifFormat(const QString &format_string_raw, const QString& datetime_format, OnFailAction onFailAction, OnFileExistsAction onFileExistsAction)
     : datetime_format(datetime_format), onFailAction(onFailAction), onFileExistsAction(onFileExistsAction) {
 
@@ -411,11 +542,12 @@ ExifFormat::ExifFormat(const QString &format_string_raw, const QString& datetime
                 valid = false;
                 break;
             }
-            if(!metaFieldsList.contains(metaField)) {
+            int field = metaFieldsList.indexOf(metaField);
+            if(field == -1) {
                 valid = false;
                 break;
             }
-            metaFieldKeys.append(metaField);
+            metaFieldIndexes.append(field);
             metaField = "";
             format_string += "%" + QString::number(param_index);
             param_index ++;
@@ -433,8 +565,9 @@ ExifFormat::ExifFormat(const QString &format_string_raw, const QString& datetime
 bool ExifFormat::rename(File &file) {
     if(valid) {
         QString final_str = format_string;
-        for(auto& key: metaFieldKeys) {
-            if(file.metadata[key].isEmpty()) {
+        for(int field: metaFieldIndexes) {
+            const QString& key = metaFieldsList.at(field);
+            if(file.metadata[field].isEmpty()) {
                 switch(onFailAction) {
                     case OnFailAction::STOP_PROCESS:
                         qCritical() << "stopped renaming on:" << file << ", (could not get" << key << ")";
@@ -447,7 +580,7 @@ bool ExifFormat::rename(File &file) {
                         break;
                 }
             }
-            final_str = final_str.arg(file.metadata[key]);
+            final_str = final_str.arg(file.metadata[field]);
         }
         illegalCharactersRemover(final_str);
         bool success = file.renameWithoutExtension(final_str);
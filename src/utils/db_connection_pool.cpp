@@ -0,0 +1,54 @@
+#include "db_connection_pool.h"
+#include "gutils.h"
+
+#include <QThreadStorage>
+#include <QAtomicInt>
+
+namespace {
+
+QAtomicInt open_connections = 0;
+QAtomicInt next_connection_id = 0;
+
+// deleted by QThreadStorage when its thread exits
+struct ThreadConnection {
+    QString name;
+
+    ~ThreadConnection() {
+        QSqlDatabase::database(name, false).close();
+        QSqlDatabase::removeDatabase(name);
+        open_connections.deref();
+    }
+};
+
+QThreadStorage<ThreadConnection*> readers;
+QThreadStorage<ThreadConnection*> connections;
+
+QSqlDatabase threadConnection(QThreadStorage<ThreadConnection*>& storage, bool read_only) {
+    if(storage.hasLocalData()) {
+        return QSqlDatabase::database(storage.localData()->name);
+    }
+
+    // names are never reused, a connection may outlive its thread until the storage is cleaned up
+    QString name = QString("%1_%2").arg(read_only ? "reader" : "conn").arg(next_connection_id.fetchAndAddRelaxed(1));
+    QSqlDatabase db = DbUtils::openDbConnection(name, DbUtils::indexDbPath());
+    if(read_only) {
+        DbUtils::execQuery(db, "PRAGMA query_only = 1");
+    }
+    storage.setLocalData(new ThreadConnection{name});
+    open_connections.ref();
+    return db;
+}
+
+}
+
+QSqlDatabase DbConnectionPool::reader() {
+    return threadConnection(readers, true);
+}
+
+QSqlDatabase DbConnectionPool::connection() {
+    return threadConnection(connections, false);
+}
+
+int DbConnectionPool::openConnections() {
+    return open_connections.loadRelaxed();
+}
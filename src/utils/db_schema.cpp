@@ -0,0 +1,187 @@
+#include "db_schema.h"
+#include "gutils.h"
+
+#include <QSqlQuery>
+#include <QSqlError>
+#include <QSqlRecord>
+#include <QFileInfo>
+#include <QHash>
+
+namespace {
+
+int userVersion(QSqlDatabase db) {
+    QSqlQuery query(db);
+    if(!query.exec("PRAGMA user_version") || !query.first()) {
+        return -1;
+    }
+    return query.value(0).toInt();
+}
+
+bool tableExists(QSqlDatabase db, const QString& table) {
+    return db.tables().contains(table);
+}
+
+bool createTables(QSqlDatabase db) {
+    QString columns;
+    for(auto meta_field: getMetaFieldsList()) {
+        columns += ", " + meta_field.replace(" ", "_") + " TEXT";
+    }
+
+    QStringList init_queries = {
+        "CREATE TABLE IF NOT EXISTS directories (id INTEGER PRIMARY KEY, path TEXT NOT NULL UNIQUE)",
+        "CREATE TABLE IF NOT EXISTS files (id INTEGER PRIMARY KEY, dir_id INTEGER NOT NULL REFERENCES directories(id), "
+            "name TEXT NOT NULL, size INTEGER, mtime INTEGER, inode INTEGER, UNIQUE(dir_id, name))",
+        QString("CREATE TABLE IF NOT EXISTS metadata (file_id INTEGER PRIMARY KEY REFERENCES files(id)%1)").arg(columns),
+        "CREATE TABLE IF NOT EXISTS hashes (file_id INTEGER PRIMARY KEY REFERENCES files(id), hash BLOB, partial_hash BLOB, perceptual_hash BLOB)",
+        "CREATE TABLE IF NOT EXISTS thumbnails (file_id INTEGER PRIMARY KEY REFERENCES files(id), thumbnail BLOB)"
+    };
+
+    for(auto& init_query: init_queries) {
+        qInfo() << "Init db:" << init_query;
+        if(!DbUtils::execQuery(db, init_query)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// version 0 -> 1, every distinct full_path becomes a files row
+// data rows whose size doesn't match the first seen size of their path are stale and dropped
+bool migrateFromV0(QSqlDatabase db) {
+    qInfo() << "Migrating db from schema version 0";
+
+    const QStringList tables = {"metadata", "hashes", "thumbnails"};
+    for(auto& table: tables) {
+        if(tableExists(db, table) && !DbUtils::execQuery(db, QString("ALTER TABLE %1 RENAME TO %1_v0").arg(table))) {
+            return false;
+        }
+    }
+    if(!createTables(db)) {
+        return false;
+    }
+
+    QHash<QString, qint64> dir_ids;
+    // full_path -> (file id, size)
+    QHash<QString, QPair<qint64, qint64>> file_ids;
+
+    QSqlQuery insert_dir(db);
+    insert_dir.prepare("INSERT INTO directories (path) VALUES (?)");
+    QSqlQuery insert_file(db);
+    insert_file.prepare("INSERT INTO files (dir_id, name, size) VALUES (?, ?, ?)");
+
+    for(auto& table: tables) {
+        QString old_table = table + "_v0";
+        if(!tableExists(db, old_table)) {
+            continue;
+        }
+
+        // copy all columns except full_path and size
+        QStringList data_columns;
+        QSqlRecord record = db.record(old_table);
+        for(int i = 0; i < record.count(); i++) {
+            if(record.fieldName(i) != "full_path" && record.fieldName(i) != "size") {
+                data_columns.append(record.fieldName(i));
+            }
+        }
+        QString placeholders = QString(", ?").repeated(data_columns.size());
+        QSqlQuery insert_data(db);
+        if(!insert_data.prepare(QString("INSERT OR REPLACE INTO %1 (file_id, %2) VALUES (?%3)")
+                                .arg(table, data_columns.join(", "), placeholders))) {
+            qCritical() << insert_data.lastError();
+            return false;
+        }
+
+        QSqlQuery select_data(db);
+        select_data.setForwardOnly(true);
+        if(!select_data.exec(QString("SELECT full_path, size, %1 FROM %2").arg(data_columns.join(", "), old_table))) {
+            qCritical() << select_data.lastError();
+            return false;
+        }
+
+        int migrated = 0;
+        while(select_data.next()) {
+            QString full_path = select_data.value(0).toString();
+            qint64 size = select_data.value(1).toLongLong();
+
+            auto file = file_ids.constFind(full_path);
+            if(file == file_ids.constEnd()) {
+                // same split as File::updateMetadata
+                QFileInfo info(full_path);
+                QString dir = info.absolutePath();
+                auto dir_id = dir_ids.constFind(dir);
+                if(dir_id == dir_ids.constEnd()) {
+                    insert_dir.bindValue(0, dir);
+                    if(!DbUtils::execQuery(insert_dir)) {
+                        return false;
+                    }
+                    dir_id = dir_ids.insert(dir, insert_dir.lastInsertId().toLongLong());
+                }
+                insert_file.bindValue(0, dir_id.value());
+                insert_file.bindValue(1, info.fileName());
+                insert_file.bindValue(2, size);
+                if(!DbUtils::execQuery(insert_file)) {
+                    return false;
+                }
+                file = file_ids.insert(full_path, {insert_file.lastInsertId().toLongLong(), size});
+            }
+
+            if(file.value().second != size) {
+                continue;
+            }
+            insert_data.bindValue(0, file.value().first);
+            for(int i = 0; i < data_columns.size(); i++) {
+                insert_data.bindValue(i + 1, select_data.value(i + 2));
+            }
+            if(!DbUtils::execQuery(insert_data)) {
+                return false;
+            }
+            migrated ++;
+        }
+        qInfo() << "Migrated" << migrated << "rows of" << table;
+
+        if(!DbUtils::execQuery(db, "DROP TABLE " + old_table)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+}
+
+bool DbSchema::init(QSqlDatabase db) {
+    int version = userVersion(db);
+    if(version < 0) {
+        qCritical() << "Could not read db schema version";
+        return false;
+    }
+    if(version > current_version) {
+        qCritical() << "Db schema version" << version << "is newer than supported version" << current_version;
+        return false;
+    }
+
+    db.transaction();
+    bool success = true;
+    bool migrated = false;
+    if(version == 0 && tableExists(db, "metadata") && !tableExists(db, "files")) {
+        success = migrateFromV0(db);
+        migrated = true;
+    } else {
+        // versions after 1 only added tables (and version 3 dropped scan_progress)
+        success = createTables(db) && DbUtils::execQuery(db, "DROP TABLE IF EXISTS scan_progress");
+    }
+    success = success && DbUtils::execQuery(db, QString("PRAGMA user_version = %1").arg(current_version));
+
+    if(!success) {
+        qCritical() << "Db schema init failed, rolling back";
+        db.rollback();
+        return false;
+    }
+    db.commit();
+
+    if(migrated) {
+        // paths were stored once per table, give the space back
+        qInfo() << "Compacting db after migration";
+        DbUtils::execQuery(db, "VACUUM");
+    }
+    return true;
+}
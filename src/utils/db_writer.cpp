@@ -0,0 +1,315 @@
+#include "db_writer.h"
+#include "gutils.h"
+#include "db_schema.h"
+
+#include <QSqlError>
+
+DbWriter::DbWriter(const QString& db_path, int batch_size, const DbUtils::StorageConfig& config)
+    : head(&stub), tail(&stub), db_path(db_path), batch_size(qMax(batch_size, 1)), config(config) {
+    thread.reset(QThread::create([this]() { run(); }));
+    thread->start();
+}
+
+DbWriter::~DbWriter() {
+    stopping = true;
+    {
+        QMutexLocker lock(&mutex);
+        records_available.wakeOne();
+    }
+    thread->wait();
+}
+
+void DbWriter::push(Record* record) {
+    enqueue(record);
+    pushed_records ++;
+
+    // only take the lock if the writer is (about to go) asleep
+    if(writer_idle) {
+        QMutexLocker lock(&mutex);
+        records_available.wakeOne();
+    }
+}
+
+void DbWriter::flush() {
+    quint64 target = pushed_records;
+    QMutexLocker lock(&mutex);
+    records_available.wakeOne();
+    while(written_records < target) {
+        batch_written.wait(&mutex);
+    }
+}
+
+void DbWriter::enqueue(Record* record) {
+    record->next.store(nullptr, std::memory_order_relaxed);
+    Record* prev = head.exchange(record, std::memory_order_acq_rel);
+    prev->next.store(record, std::memory_order_release);
+}
+
+DbWriter::Record* DbWriter::pop() {
+    Record* current = tail;
+    Record* next = current->next.load(std::memory_order_acquire);
+    if(current == &stub) {
+        if(!next) {
+            return nullptr;
+        }
+        tail = next;
+        current = next;
+        next = next->next.load(std::memory_order_acquire);
+    }
+    if(next) {
+        tail = next;
+        return current;
+    }
+    if(current != head.load(std::memory_order_acquire)) {
+        // a producer is between swapping head and linking its record, try again later
+        return nullptr;
+    }
+    // current is the last record, put the stub behind it so that it can be taken
+    enqueue(&stub);
+    next = current->next.load(std::memory_order_acquire);
+    if(next) {
+        tail = next;
+        return current;
+    }
+    return nullptr;
+}
+
+bool DbWriter::queueEmpty() {
+    return tail == &stub ? !stub.next.load(std::memory_order_acquire) : false;
+}
+
+bool DbWriter::prepareQueries(QSqlDatabase db, Queries& queries) {
+    QString columns;
+    QString values;
+    for(auto meta_field: getMetaFieldsList()) {
+        columns += "," + meta_field.replace(" ", "_");
+        values += ", ?";
+    }
+
+    const QList<QPair<QSqlQuery*, QString>> statements = {
+        {&queries.select_dir, "SELECT id FROM directories WHERE path = ?"},
+        {&queries.insert_dir, "INSERT INTO directories (path) VALUES (?)"},
+        {&queries.select_file, "SELECT id, size, mtime, inode FROM files WHERE dir_id = ? AND name = ?"},
+        {&queries.insert_file, "INSERT INTO files (dir_id, name, size, mtime, inode) VALUES (?, ?, ?, ?, ?)"},
+        {&queries.update_file, "UPDATE files SET size = ?, mtime = ?, inode = ? WHERE id = ?"},
+        {&queries.invalidate_hash, "DELETE FROM hashes WHERE file_id = ?"},
+        {&queries.invalidate_metadata, "DELETE FROM metadata WHERE file_id = ?"},
+        {&queries.invalidate_thumbnail, "DELETE FROM thumbnails WHERE file_id = ?"},
+        {&queries.remove_file, "DELETE FROM files WHERE id = ?"},
+        {&queries.hash, "INSERT OR REPLACE INTO hashes (file_id, hash, partial_hash, perceptual_hash) VALUES(?, ?, ?, ?)"},
+        {&queries.metadata, QString("INSERT OR REPLACE INTO metadata (file_id%1) VALUES(?%2)").arg(columns, values)},
+        {&queries.thumbnail, "INSERT OR REPLACE INTO thumbnails (file_id, thumbnail) VALUES(?, ?)"}
+    };
+
+    for(auto& [query, statement]: statements) {
+        *query = QSqlQuery(db);
+        if(!query->prepare(statement)) {
+            qCritical() << query->lastError() << " query: " << statement;
+            return false;
+        }
+    }
+    return true;
+}
+
+void DbWriter::clearDirCache() {
+    dir_ids.clear();
+    table_dir_ids.clear();
+}
+
+qint64 DbWriter::dirId(Queries& queries, const Record& record) {
+    // interned directories are looked up by their id, without hashing the path
+    if(record.dir_id >= 0 && record.dir_id < table_dir_ids.size() && table_dir_ids[record.dir_id] > 0) {
+        return table_dir_ids[record.dir_id];
+    }
+
+    auto dir_id = dir_ids.constFind(record.dir);
+    if(dir_id == dir_ids.constEnd()) {
+        qint64 id;
+        queries.select_dir.bindValue(0, record.dir);
+        DbUtils::execQuery(queries.select_dir);
+        if(queries.select_dir.first()) {
+            id = queries.select_dir.value(0).toLongLong();
+        } else {
+            queries.insert_dir.bindValue(0, record.dir);
+            if(!DbUtils::execQuery(queries.insert_dir)) {
+                return -1;
+            }
+            id = queries.insert_dir.lastInsertId().toLongLong();
+        }
+        queries.select_dir.finish();
+        dir_id = dir_ids.insert(record.dir, id);
+    }
+
+    if(record.dir_id >= 0) {
+        if(record.dir_id >= table_dir_ids.size()) {
+            table_dir_ids.resize(record.dir_id + 1);
+        }
+        table_dir_ids[record.dir_id] = dir_id.value();
+    }
+    return dir_id.value();
+}
+
+qint64 DbWriter::fileId(Queries& queries, const Record& record) {
+    qint64 dir_id = dirId(queries, record);
+    if(dir_id < 0) {
+        return -1;
+    }
+
+    queries.select_file.bindValue(0, dir_id);
+    queries.select_file.bindValue(1, record.name);
+    DbUtils::execQuery(queries.select_file);
+    if(!queries.select_file.first()) {
+        queries.select_file.finish();
+        queries.insert_file.bindValue(0, dir_id);
+        queries.insert_file.bindValue(1, record.name);
+        queries.insert_file.bindValue(2, record.size_bytes);
+        queries.insert_file.bindValue(3, record.mtime_ms);
+        queries.insert_file.bindValue(4, record.inode);
+        if(!DbUtils::execQuery(queries.insert_file)) {
+            return -1;
+        }
+        return queries.insert_file.lastInsertId().toLongLong();
+    }
+
+    qint64 id = queries.select_file.value(0).toLongLong();
+    qint64 size = queries.select_file.value(1).toLongLong();
+    QVariant mtime = queries.select_file.value(2);
+    quint64 inode = queries.select_file.value(3).toULongLong();
+    queries.select_file.finish();
+
+    bool changed = size != record.size_bytes || (!mtime.isNull() && mtime.toLongLong() != record.mtime_ms);
+    if(changed) {
+        // the file was modified, everything cached for it is stale
+        for(QSqlQuery* invalidate: {&queries.invalidate_hash, &queries.invalidate_metadata, &queries.invalidate_thumbnail}) {
+            invalidate->bindValue(0, id);
+            DbUtils::execQuery(*invalidate);
+        }
+    }
+    if(changed || mtime.isNull() || inode != record.inode) {
+        queries.update_file.bindValue(0, record.size_bytes);
+        queries.update_file.bindValue(1, record.mtime_ms);
+        queries.update_file.bindValue(2, record.inode);
+        queries.update_file.bindValue(3, id);
+        DbUtils::execQuery(queries.update_file);
+    }
+    return id;
+}
+
+void DbWriter::write(Queries& queries, const Record& record) {
+    if(record.type == Record::REMOVE) {
+        // a folder that isn't indexed has nothing to remove, no directories row is created for it
+        // (unused directories rows are left to index maintenance)
+        auto cached_dir_id = dir_ids.constFind(record.dir);
+        qint64 dir_id = -1;
+        if(cached_dir_id != dir_ids.constEnd()) {
+            dir_id = cached_dir_id.value();
+        } else {
+            queries.select_dir.bindValue(0, record.dir);
+            DbUtils::execQuery(queries.select_dir);
+            if(queries.select_dir.first()) {
+                dir_id = queries.select_dir.value(0).toLongLong();
+            }
+            queries.select_dir.finish();
+        }
+        if(dir_id == -1) {
+            return;
+        }
+        queries.select_file.bindValue(0, dir_id);
+        queries.select_file.bindValue(1, record.name);
+        DbUtils::execQuery(queries.select_file);
+        bool indexed = queries.select_file.first();
+        qint64 file_id = indexed ? queries.select_file.value(0).toLongLong() : -1;
+        queries.select_file.finish();
+        if(!indexed) {
+            return;
+        }
+        for(QSqlQuery* remove: {&queries.invalidate_hash, &queries.invalidate_metadata, &queries.invalidate_thumbnail, &queries.remove_file}) {
+            remove->bindValue(0, file_id);
+            DbUtils::execQuery(*remove);
+        }
+        return;
+    }
+
+    qint64 file_id = fileId(queries, record);
+    if(file_id == -1) {
+        return;
+    }
+    QSqlQuery& query = record.type == Record::HASH ? queries.hash :
+                       record.type == Record::METADATA ? queries.metadata : queries.thumbnail;
+    query.bindValue(0, file_id);
+    switch(record.type) {
+        case Record::HASH:
+            query.bindValue(1, record.hash);
+            query.bindValue(2, record.partial_hash);
+            query.bindValue(3, record.perceptual_hash);
+            break;
+        case Record::METADATA:
+            for(int i = 0; i < meta_fields_count; i++) {
+                query.bindValue(i + 1, record.metadata[i]);
+            }
+            break;
+        case Record::THUMBNAIL:
+            query.bindValue(1, record.thumbnail);
+            break;
+        default:
+            break;
+    }
+    DbUtils::execQuery(query);
+}
+
+void DbWriter::run() {
+    QString connection_name = QString("db_writer_%1").arg((quintptr)this);
+    QSqlDatabase db = db_path.isEmpty() ? DbUtils::openDbConnection() : DbUtils::openDbConnection(connection_name, db_path, config);
+    if(!db_path.isEmpty() && !DbSchema::init(db)) {
+        qCritical() << "Db writer could not initialize" << db_path;
+    }
+
+    Queries queries;
+    if(!prepareQueries(db, queries)) {
+        qCritical() << "Db writer could not prepare queries:" << db.lastError();
+    }
+
+    for(;;) {
+        Record* record = pop();
+        if(!record) {
+            if(stopping && pushed_records == written_records) {
+                break;
+            }
+            QMutexLocker lock(&mutex);
+            writer_idle = true;
+            if(queueEmpty()) {
+                // the timeout covers a producer that is still linking its record
+                records_available.wait(&mutex, 100);
+            }
+            writer_idle = false;
+            continue;
+        }
+
+        if(dir_ids_stale.exchange(false)) {
+            clearDirCache();
+        }
+
+        db.transaction();
+        int written = 0;
+        for(; record; record = written < batch_size ? pop() : nullptr) {
+            write(queries, *record);
+            delete record;
+            written ++;
+        }
+        if(!db.commit()) {
+            qCritical() << "Db writer commit failed:" << db.lastError();
+            // ids of directories created in the failed transaction are gone
+            clearDirCache();
+        }
+
+        QMutexLocker lock(&mutex);
+        written_records += written;
+        batch_written.wakeAll();
+    }
+
+    db.close();
+    if(!db_path.isEmpty()) {
+        db = QSqlDatabase();
+        QSqlDatabase::removeDatabase(connection_name);
+    }
+}
@@ -0,0 +1,269 @@
+#include "external_sorter.h"
+
+#include <QDebug>
+#include <QtEndian>
+
+#include <algorithm>
+#include <cstring>
+
+namespace {
+
+// heap allocations and bookkeeping of a buffered record, on top of the key and path
+const int kRecordOverhead = 64;
+
+// all keys of a sorter have the same size
+bool keyLess(const QByteArray& a, const QByteArray& b) {
+    return std::memcmp(a.constData(), b.constData(), a.size()) < 0;
+}
+
+}
+
+bool ExternalSorter::writeRecord(QDataStream& stream, const QByteArray& key, const QString& path) {
+    stream.writeRawData(key.constData(), key.size());
+    stream << path;
+    return stream.status() == QDataStream::Ok;
+}
+
+ExternalSorter::ExternalSorter(const QString& temp_dir, int key_size, qint64 memory_budget_bytes)
+    : dir(temp_dir + "/disk_deduper_sort_XXXXXX"), key_size(key_size), memory_budget_bytes(memory_budget_bytes) {
+    if(!dir.isValid()) {
+        qCritical() << "Failed creating sort directory in" << temp_dir << ":" << dir.errorString();
+    }
+}
+
+QByteArray ExternalSorter::sizeKey(qint64 size_bytes) {
+    QByteArray key(sizeof(size_bytes), '\0');
+    qToBigEndian(size_bytes, key.data());
+    return key;
+}
+
+bool ExternalSorter::add(const QByteArray& key, const QString& path) {
+    Q_ASSERT(key.size() == key_size);
+    buffer.append({key, path});
+    buffer_bytes += key_size + path.size() * sizeof(QChar) + kRecordOverhead;
+    record_count ++;
+    if(buffer_bytes >= memory_budget_bytes) {
+        return spill();
+    }
+    return true;
+}
+
+QString ExternalSorter::newRunPath() {
+    return dir.filePath(QString("run_%1").arg(spilled_runs++));
+}
+
+bool ExternalSorter::ownsRun(const QString& run_path) const {
+    return run_path.startsWith(dir.path() + "/");
+}
+
+void ExternalSorter::addRun(const QString& run_path) {
+    run_paths.append(run_path);
+}
+
+bool ExternalSorter::spill() {
+    std::sort(buffer.begin(), buffer.end(), [](const Record& a, const Record& b) {
+        return keyLess(a.key, b.key);
+    });
+
+    QString run_path = newRunPath();
+    QFile file(run_path);
+    if(!file.open(QIODevice::WriteOnly)) {
+        qCritical() << "Failed writing sort run" << run_path << ":" << file.errorString();
+        return false;
+    }
+    QDataStream stream(&file);
+    for(auto& record: buffer) {
+        if(!writeRecord(stream, record.key, record.path)) {
+            qCritical() << "Failed writing sort run" << run_path << ":" << file.errorString();
+            return false;
+        }
+    }
+    run_paths.append(run_path);
+    qDebug() << "Spilled" << buffer.size() << "records to" << run_path;
+
+    buffer.clear();
+    buffer.squeeze();
+    buffer_bytes = 0;
+    return true;
+}
+
+bool ExternalSorter::RunReader::read(int key_size) {
+    // records end exactly at the end of the file, anything else is a truncated or unreadable run
+    if(stream.atEnd()) {
+        return false;
+    }
+    key.resize(key_size);
+    if(stream.readRawData(key.data(), key_size) != key_size) {
+        failed = true;
+        return false;
+    }
+    stream >> path;
+    failed = stream.status() != QDataStream::Ok;
+    return !failed;
+}
+
+bool ExternalSorter::openReaders(const QStringList& paths) {
+    readers.clear();
+    for(auto& path: paths) {
+        auto reader = std::make_unique<RunReader>();
+        reader->file.setFileName(path);
+        if(!reader->file.open(QIODevice::ReadOnly)) {
+            qCritical() << "Failed reading sort run" << path << ":" << reader->file.errorString();
+            return false;
+        }
+        reader->stream.setDevice(&reader->file);
+        if(reader->read(key_size)) {
+            readers.push_back(std::move(reader));
+        } else if(reader->failed) {
+            qCritical() << "Failed reading sort run" << path << ": truncated or unreadable";
+            read_failed = true;
+            return false;
+        }
+    }
+    std::make_heap(readers.begin(), readers.end(), [](const uptr<RunReader>& a, const uptr<RunReader>& b) {
+        return keyLess(b->key, a->key);
+    });
+    return true;
+}
+
+bool ExternalSorter::readNext(QByteArray& key, QString& path) {
+    // everything fit in memory
+    if(run_paths.isEmpty()) {
+        if(buffer_pos >= buffer.size()) {
+            return false;
+        }
+        key = buffer[buffer_pos].key;
+        path = buffer[buffer_pos].path;
+        buffer_pos ++;
+        return true;
+    }
+
+    if(read_failed || readers.empty()) {
+        return false;
+    }
+    auto min_first = [](const uptr<RunReader>& a, const uptr<RunReader>& b) {
+        return keyLess(b->key, a->key);
+    };
+    std::pop_heap(readers.begin(), readers.end(), min_first);
+    RunReader& reader = *readers.back();
+    key = reader.key;
+    path = reader.path;
+    if(reader.read(key_size)) {
+        std::push_heap(readers.begin(), readers.end(), min_first);
+    } else if(reader.failed) {
+        // the rest of that run is lost, stop instead of returning an incomplete merge
+        qCritical() << "Failed reading sort run" << reader.file.fileName() << ": truncated or unreadable";
+        read_failed = true;
+        readers.clear();
+        return false;
+    } else {
+        readers.pop_back();
+    }
+    return true;
+}
+
+bool ExternalSorter::mergeRuns(const QStringList& inputs, const QString& output) {
+    if(!openReaders(inputs)) {
+        return false;
+    }
+    QFile file(output);
+    if(!file.open(QIODevice::WriteOnly)) {
+        qCritical() << "Failed writing sort run" << output << ":" << file.errorString();
+        return false;
+    }
+    QDataStream stream(&file);
+    QByteArray key;
+    QString path;
+    while(readNext(key, path)) {
+        if(!writeRecord(stream, key, path)) {
+            qCritical() << "Failed writing sort run" << output << ":" << file.errorString();
+            return false;
+        }
+    }
+    if(read_failed) {
+        return false;
+    }
+    readers.clear();
+    for(auto& input: inputs) {
+        if(ownsRun(input)) {
+            QFile::remove(input);
+        }
+    }
+    return true;
+}
+
+bool ExternalSorter::reduceRuns() {
+    while(run_paths.size() > max_merge_fan_in) {
+        QStringList inputs = run_paths.mid(0, max_merge_fan_in);
+        QString output = newRunPath();
+        if(!mergeRuns(inputs, output)) {
+            return false;
+        }
+        run_paths = run_paths.mid(max_merge_fan_in);
+        run_paths.append(output);
+    }
+    return true;
+}
+
+bool ExternalSorter::finish() {
+    if(run_paths.isEmpty()) {
+        std::sort(buffer.begin(), buffer.end(), [](const Record& a, const Record& b) {
+            return keyLess(a.key, b.key);
+        });
+    } else {
+        if(!buffer.isEmpty() && !spill()) {
+            return false;
+        }
+        if(!reduceRuns() || !openReaders(run_paths)) {
+            return false;
+        }
+    }
+    has_next = readNext(next_key, next_path);
+    return !read_failed;
+}
+
+bool ExternalSorter::next(QByteArray& key, QString& path) {
+    // finish() already read the first record
+    if(!has_next) {
+        return false;
+    }
+    key = next_key;
+    path = next_path;
+    has_next = readNext(next_key, next_path);
+    return true;
+}
+
+bool ExternalSorter::writeTo(const QString& run_path) {
+    // the buffer becomes a run even if it's the only one
+    if((!buffer.isEmpty() || run_paths.isEmpty()) && !spill()) {
+        return false;
+    }
+    if(!reduceRuns()) {
+        return false;
+    }
+    // a single own run is already sorted
+    if(run_paths.size() == 1 && ownsRun(run_paths.first())) {
+        QFile::remove(run_path);
+        if(QFile::rename(run_paths.first(), run_path)) {
+            run_paths.clear();
+            return true;
+        }
+    }
+    return mergeRuns(run_paths, run_path);
+}
+
+bool ExternalSorter::nextDuplicate(QByteArray& key, QString& path) {
+    // a record is a duplicate if its key is the same as the one before or after it
+    while(has_next) {
+        key = next_key;
+        path = next_path;
+        bool same_as_previous = has_previous && key == previous_key;
+        previous_key = key;
+        has_previous = true;
+        has_next = readNext(next_key, next_path);
+        if(same_as_previous || (has_next && next_key == key)) {
+            return true;
+        }
+    }
+    return false;
+}
@@ -0,0 +1,221 @@
+#include "file_table.h"
+
+#include <QDateTime>
+#include <QMap>
+
+#include <cstring>
+#include <sys/stat.h>
+#include <numeric>
+#include <algorithm>
+
+void FileTable::clear() {
+    dir_paths.clear();
+    dir_ids.clear();
+    name_pool.clear();
+    dir_col.clear();
+    name_offset_col.clear();
+    name_len_col.clear();
+    size_col.clear();
+    mtime_col.clear();
+    inode_col.clear();
+    device_col.clear();
+    hash_col.clear();
+    partial_hash_col.clear();
+    flags_col.clear();
+}
+
+void FileTable::reserve(int files) {
+    dir_col.reserve(files);
+    name_offset_col.reserve(files);
+    name_len_col.reserve(files);
+    size_col.reserve(files);
+    mtime_col.reserve(files);
+    inode_col.reserve(files);
+    device_col.reserve(files);
+    hash_col.reserve(files);
+    partial_hash_col.reserve(files);
+    flags_col.reserve(files);
+}
+
+quint32 FileTable::internDir(const QString& path) {
+    auto id = dir_ids.constFind(path);
+    if(id != dir_ids.constEnd()) {
+        return id.value();
+    }
+    quint32 new_id = dir_paths.size();
+    dir_paths.append(path);
+    dir_ids.insert(path, new_id);
+    return new_id;
+}
+
+bool FileTable::storeDigest(Digest& slot, const QByteArray& digest) {
+    if(digest.size() != digest_size) {
+        return false;
+    }
+    std::memcpy(slot.data(), digest.constData(), digest_size);
+    return true;
+}
+
+quint32 FileTable::appendRow(quint32 dir_id, const QString& name, qint64 size_bytes, qint64 mtime_ms, quint64 inode, quint64 device, quint8 flags) {
+    quint32 index = size_col.size();
+    dir_col.append(dir_id);
+    name_offset_col.append(name_pool.size());
+    name_len_col.append(name.size());
+    name_pool += name;
+    size_col.append(size_bytes);
+    mtime_col.append(mtime_ms);
+    inode_col.append(inode);
+    device_col.append(device);
+    hash_col.append({});
+    partial_hash_col.append({});
+    flags_col.append(flags);
+    return index;
+}
+
+quint32 FileTable::append(const File& file) {
+    quint32 index = appendRow(internDir(file.path_without_name), file.name, file.size_bytes, file.mtime_ms, file.inode, file.device, file.offline ? OFFLINE : 0);
+    update(index, file);
+    return index;
+}
+
+quint32 FileTable::append(quint32 dir_id, const QFileInfo& info) {
+    // size and mtime are cached in info, only the file identity needs another stat
+    struct stat st;
+    bool stated = stat(QFile::encodeName(info.absoluteFilePath()).constData(), &st) == 0;
+    return appendRow(dir_id, info.fileName(), info.size(), info.lastModified().toMSecsSinceEpoch(),
+                     stated ? st.st_ino : 0, stated ? st.st_dev : 0, 0);
+}
+
+void FileTable::update(quint32 index, const File& file) {
+    if(storeDigest(hash_col[index], file.hash)) {
+        flags_col[index] |= HAS_HASH;
+    }
+    if(storeDigest(partial_hash_col[index], file.partial_hash)) {
+        flags_col[index] |= HAS_PARTIAL_HASH;
+    }
+}
+
+QString FileTable::name(quint32 index) const {
+    return nameView(index).toString();
+}
+
+QString FileTable::fullPath(quint32 index) const {
+    const QString& dir = dir_paths[dir_col[index]];
+    QStringView name = nameView(index);
+    QString path;
+    path.reserve(dir.size() + 1 + name.size());
+    path += dir;
+    if(!dir.endsWith('/')) {
+        path += '/';
+    }
+    path.append(name.data(), name.size());
+    return path;
+}
+
+File FileTable::file(quint32 index) const {
+    // the directory string is shared with the table
+    File file(dir_paths[dir_col[index]], name(index), size_col[index], mtime_col[index]);
+    file.dir_id = dir_col[index];
+    file.inode = inode_col[index];
+    file.device = device_col[index];
+    file.offline = isOffline(index);
+    if(hasHash(index)) {
+        file.hash = QByteArray((const char*)hash_col[index].data(), digest_size);
+    }
+    if(hasPartialHash(index)) {
+        file.partial_hash = QByteArray((const char*)partial_hash_col[index].data(), digest_size);
+    }
+    return file;
+}
+
+QVector<quint32> FileTable::indexes() const {
+    QVector<quint32> all(size());
+    std::iota(all.begin(), all.end(), 0);
+    return all;
+}
+
+MultiFile FileTable::files() const {
+    MultiFile all;
+    all.reserve(size());
+    for(int i = 0; i < size(); i++) {
+        if(!isOffline(i)) {
+            all.append(file(i));
+        }
+    }
+    return all;
+}
+
+void FileTable::removeDuplicatePaths() {
+    // same directory strings have the same id, so a path is identified by (dir id, name)
+    // an online row sorts before an offline (catalog) one of the same path, unique keeps it
+    QVector<quint32> order = indexes();
+    std::sort(order.begin(), order.end(), [this](quint32 a, quint32 b) {
+        if(dir_col[a] != dir_col[b]) {
+            return dir_paths[dir_col[a]] < dir_paths[dir_col[b]];
+        }
+        int names = nameView(a).compare(nameView(b));
+        if(names != 0) {
+            return names < 0;
+        }
+        return !isOffline(a) && isOffline(b);
+    });
+    order.erase(std::unique(order.begin(), order.end(), [this](quint32 a, quint32 b) {
+        return dir_col[a] == dir_col[b] && nameView(a) == nameView(b);
+    }), order.end());
+
+    keepRows(order);
+}
+
+QVector<QStringList> FileTable::removeHardLinks() {
+    QHash<QPair<quint64, quint64>, quint32> first_links;
+    // kept row -> all paths of the file
+    QMap<quint32, QStringList> link_sets;
+    QVector<quint32> kept;
+    kept.reserve(size());
+
+    for(int i = 0; i < size(); i++) {
+        // inode 0: stat failed (or offline entry), nothing to compare
+        if(isOffline(i) || inode_col[i] == 0) {
+            kept.append(i);
+            continue;
+        }
+        auto identity = qMakePair(device_col[i], inode_col[i]);
+        auto first = first_links.constFind(identity);
+        if(first == first_links.constEnd()) {
+            first_links.insert(identity, i);
+            kept.append(i);
+            continue;
+        }
+        QStringList& paths = link_sets[first.value()];
+        if(paths.isEmpty()) {
+            paths.append(fullPath(first.value()));
+        }
+        paths.append(fullPath(i));
+    }
+
+    if(kept.size() != size()) {
+        keepRows(kept);
+    }
+    return link_sets.values().toVector();
+}
+
+void FileTable::keepRows(const QVector<quint32>& rows) {
+    auto reorder = [&rows](auto& column) {
+        std::remove_reference_t<decltype(column)> kept;
+        kept.reserve(rows.size());
+        for(auto index: rows) {
+            kept.append(column[index]);
+        }
+        column.swap(kept);
+    };
+    reorder(dir_col);
+    reorder(name_offset_col);
+    reorder(name_len_col);
+    reorder(size_col);
+    reorder(mtime_col);
+    reorder(inode_col);
+    reorder(device_col);
+    reorder(hash_col);
+    reorder(partial_hash_col);
+    reorder(flags_col);
+}
@@ -1,4 +1,5 @@
 #include "gutils.h"
+#include "db_connection_pool.h"
 #include "phash.h"
 
 #include <QFileDialog>
@@ -12,25 +13,13 @@ const QMap<QString, quint64> size_multipliers = {{"b", 1}, {"Kb", 1024}, {"Mb",
 void FileUtils::walkDir(const QString& dir, const QStringList& blacklisted_dirs, const QStringList& extensions,
              ExtenstionFilterState extFilterState, std::function<void(const QString&)> callback) {
 
-    bool ext_filter_enabled = extFilterState != ExtenstionFilterState::DISABLED;
-    bool blacklist_ext = extFilterState == ExtenstionFilterState::ENABLED_BLACK;
-
     QDir directory(dir);
     directory.setFilter(QDir::Dirs | QDir::Files | QDir::NoDotAndDotDot | QDir::NoSymLinks);
 
     QFileInfoList list = directory.entryInfoList();
     for(const auto& file_or_folder: list) {
         if(file_or_folder.isFile()) {
-            bool ends_with_ext = !ext_filter_enabled;
-            if(ext_filter_enabled) {
-                for(const auto& extension: extensions) {
-                    if(file_or_folder.fileName().toLower().endsWith("." + extension)) {
-                        ends_with_ext = true;
-                        break;
-                    }
-                }
-            }
-            if(ends_with_ext != blacklist_ext || !ext_filter_enabled) {
+            if(passesExtensionFilter(file_or_folder.fileName(), extensions, extFilterState)) {
                 callback(file_or_folder.absoluteFilePath());
             }
         } else if (file_or_folder.isDir() && !blacklisted_dirs.contains(file_or_folder.absoluteFilePath())){
@@ -39,12 +28,53 @@ void FileUtils::walkDir(const QString& dir, const QStringList& blacklisted_dirs,
     }
 }
 
+void FileUtils::walkDirByDirectory(const QString& dir, const QStringList& blacklisted_dirs, const QStringList& extensions,
+                                   ExtenstionFilterState extFilterState, std::function<void(const QString& dir, const QFileInfoList& files)> callback) {
+
+    QDir directory(dir);
+    directory.setFilter(QDir::Dirs | QDir::Files | QDir::NoDotAndDotDot | QDir::NoSymLinks);
+
+    QFileInfoList files;
+    QStringList sub_dirs;
+    for(const auto& file_or_folder: directory.entryInfoList()) {
+        if(file_or_folder.isFile()) {
+            if(passesExtensionFilter(file_or_folder.fileName(), extensions, extFilterState)) {
+                files.append(file_or_folder);
+            }
+        } else if (file_or_folder.isDir() && !blacklisted_dirs.contains(file_or_folder.absoluteFilePath())){
+            sub_dirs.append(file_or_folder.absoluteFilePath());
+        }
+    }
+    if(!files.isEmpty()) {
+        callback(directory.absolutePath(), files);
+    }
+    for(const auto& sub_dir: sub_dirs) {
+        walkDirByDirectory(sub_dir, blacklisted_dirs, extensions, extFilterState, callback);
+    }
+}
+
+bool FileUtils::passesExtensionFilter(const QString& file_name, const QStringList& extensions, ExtenstionFilterState extFilterState) {
+    if(extFilterState == ExtenstionFilterState::DISABLED) {
+        return true;
+    }
+
+    bool ends_with_ext = false;
+    for(const auto& extension: extensions) {
+        if(file_name.toLower().endsWith("." + extension)) {
+            ends_with_ext = true;
+            break;
+        }
+    }
+    return ends_with_ext != (extFilterState == ExtenstionFilterState::ENABLED_BLACK);
+}
+
 PairList<File, QString> FileUtils::queueFilesToModify(MultiFile &files_to_delete,
                                               const QString& target_dir, const QString& postfix) {
     PairList<File, QString> list;
 
     for(auto& file: files_to_delete) {
-        if(file.valid) {
+        // offline catalog entries are only known by their hashes, the file isn't there
+        if(file.valid && !file.offline) {
             QFile file_real (file);
             QDir dir = target_dir + file.path_without_name;
             dir.mkpath(dir.absolutePath());
@@ -89,14 +119,19 @@ bool FileUtils::deleteOrRenameFiles(PairList<File, QString> &files_to_delete,
 }
 
 
+// an empty hash means the file couldn't be read, such files are skipped when comparing
 QByteArray FileUtils::getFileHash(const QString& full_path) {
     QFile file = QFile(full_path);
     if (!file.open(QIODevice::ReadOnly)) {
-        qFatal("Failed opening %s", full_path.toLatin1().constData());
+        qWarning() << "Failed opening" << full_path << file.errorString();
+        return QByteArray();
     }
 
     QCryptographicHash hash(QCryptographicHash::Algorithm::Sha256);
-    hash.addData(&file);
+    if (!hash.addData(&file)) {
+        qWarning() << "Failed reading" << full_path << file.errorString();
+        return QByteArray();
+    }
 
     return hash.result();
 }
@@ -104,7 +139,8 @@ QByteArray FileUtils::getFileHash(const QString& full_path) {
 QByteArray FileUtils::getPartialFileHash(const QString &full_path) {
     QFile file = QFile(full_path);
     if (!file.open(QIODevice::ReadOnly)) {
-        qFatal("Failed opening %s", full_path.toLatin1().constData());
+        qWarning() << "Failed opening" << full_path << file.errorString();
+        return QByteArray();
     }
 
     file.seek(file.size() / 2);
@@ -137,12 +173,15 @@ bool FileUtils::comparePerceptualHashes(const QByteArray &hash1, const QByteArra
 }
 
 // make sure to sort the array before passing
-QByteArray FileUtils::getFileGroupFingerprint(const QVector<File>& group) {
-    QString combined_dir;
-    for(const auto& file: group) {
-        combined_dir += file.path_without_name;
+QByteArray FileUtils::getFileGroupFingerprint(const MultiFile& files, const FileIndexes& group) {
+    // the sequence of directory ids, equal sequences mean equal directories
+    QByteArray fingerprint;
+    fingerprint.reserve(group.size() * sizeof(int));
+    for(auto index: group) {
+        int dir_id = files.at(index).dir_id;
+        fingerprint.append((const char*)&dir_id, sizeof(dir_id));
     }
-    return StringUtils::getStringHash(combined_dir);
+    return fingerprint;
 };
 
 QByteArray StringUtils::getStringHash(const QString& string) {
@@ -313,17 +352,36 @@ bool DbUtils::execQuery(QSqlDatabase db, const QString& query_str) {
     return true;
 }
 
+QString DbUtils::indexDbPath() {
+    return QDir(QApplication::applicationDirPath()).filePath("index.db");
+}
+
 QSqlDatabase DbUtils::openDbConnection() {
-    // make a new connaction with current thread id
-    QSqlDatabase storage_db = QSqlDatabase::addDatabase("QSQLITE", QString("conn_%1").arg((uintptr_t)QThread::currentThread()));
+    return DbConnectionPool::connection();
+}
+
+QSqlDatabase DbUtils::openDbConnection(const QString& connection_name, const QString& db_path, const StorageConfig& config) {
+    QSqlDatabase storage_db = QSqlDatabase::addDatabase("QSQLITE", connection_name);
     qInfo() << "Opened db connection " << storage_db.connectionName();
-    storage_db.setDatabaseName(QDir(QApplication::applicationDirPath()).filePath("index.db"));
+    storage_db.setDatabaseName(db_path);
     if(!storage_db.open()) {
         qCritical() << storage_db.lastError();
+    } else {
+        applyStorageConfig(storage_db, config);
     }
     return storage_db;
 }
 
+void DbUtils::applyStorageConfig(QSqlDatabase db, const StorageConfig& config) {
+    // journal mode is stored in the db file, the rest only applies to this connection
+    execQuery(db, QString("PRAGMA journal_mode = %1").arg(config.wal ? "WAL" : "DELETE"));
+    execQuery(db, QString("PRAGMA synchronous = %1").arg(config.synchronous_normal ? "NORMAL" : "FULL"));
+    // negative cache size is in KiB instead of pages
+    execQuery(db, QString("PRAGMA cache_size = -%1").arg(config.cache_size_kib));
+    execQuery(db, QString("PRAGMA mmap_size = %1").arg(config.mmap_size_bytes));
+    execQuery(db, QString("PRAGMA temp_store = %1").arg(config.temp_store_memory ? "MEMORY" : "DEFAULT"));
+}
+
 void UiUtils::connectDialogButtonBox(QDialog *dialog, QDialogButtonBox *buttonBox) {
     dialog->connect(buttonBox, &QDialogButtonBox::accepted, dialog, &QDialog::accept);
     dialog->connect(buttonBox, &QDialogButtonBox::rejected, dialog, &QDialog::reject);
@@ -0,0 +1,213 @@
+#include "hash_catalog.h"
+
+#include <QDir>
+#include <QFileInfo>
+#include <QStorageInfo>
+#include <QDirIterator>
+#include <QDateTime>
+#include <QDebug>
+
+#include <cstring>
+
+// catalogs are mapped as-is, the layout must not depend on the compiler
+static_assert(sizeof(HashCatalog::Header) == 64, "unexpected catalog header layout");
+static_assert(sizeof(HashCatalog::Entry) == 96, "unexpected catalog entry layout");
+static_assert(Q_BYTE_ORDER == Q_LITTLE_ENDIAN, "catalogs are stored in little endian");
+
+namespace {
+
+const char kMagic[8] = {'D', 'D', 'C', 'A', 'T', 'A', 'L', 'G'};
+const quint32 kVersion = 1;
+
+void copyDigest(quint8* dest, const QByteArray& digest) {
+    std::memcpy(dest, digest.constData(), HashCatalog::digest_size);
+}
+
+}
+
+const QString HashCatalog::file_extension = "ddcat";
+
+HashCatalog::~HashCatalog() {
+    close();
+}
+
+bool HashCatalog::isCatalogPath(const QString& path) {
+    return path.endsWith("." + file_extension, Qt::CaseInsensitive) && QFileInfo(path).isFile();
+}
+
+QString HashCatalog::volumeId(const QString& path) {
+    QStorageInfo storage(path);
+    QString device = QString::fromLocal8Bit(storage.device());
+
+    // the uuid identifies the filesystem even if it is mounted somewhere else
+    QString uuid;
+    QDirIterator it("/dev/disk/by-uuid", QDir::Files | QDir::System);
+    while(it.hasNext()) {
+        it.next();
+        if(it.fileInfo().canonicalFilePath() == QFileInfo(device).canonicalFilePath()) {
+            uuid = it.fileName();
+            break;
+        }
+    }
+
+    QString label = storage.name().isEmpty() ? device : storage.name();
+    return uuid.isEmpty() ? label : QString("%1 (%2)").arg(label, uuid);
+}
+
+bool HashCatalog::write(const QString& catalog_path, const QString& root, const MultiFile& files) {
+    QDir root_dir(root);
+    QByteArray root_utf8 = root_dir.absolutePath().toUtf8();
+    QByteArray volume_utf8 = volumeId(root).toUtf8();
+
+    struct PendingEntry {
+        QByteArray relative_path;
+        const File* file;
+    };
+    QVector<PendingEntry> pending;
+    pending.reserve(files.size());
+    for(auto& file: files) {
+        // only full size digests can be stored
+        bool has_hash = file.hash.size() == digest_size;
+        bool has_partial_hash = file.partial_hash.size() == digest_size;
+        if(!has_hash && !has_partial_hash) {
+            continue;
+        }
+        pending.append({root_dir.relativeFilePath(file).toUtf8(), &file});
+    }
+    std::sort(pending.begin(), pending.end(), [](const PendingEntry& a, const PendingEntry& b) {
+        return a.relative_path < b.relative_path;
+    });
+
+    QByteArray string_pool = root_utf8 + volume_utf8;
+    QVector<Entry> entries(pending.size());
+    for(int i = 0; i < pending.size(); i++) {
+        const File& file = *pending[i].file;
+        Entry& entry = entries[i];
+        std::memset(&entry, 0, sizeof(Entry));
+        entry.size_bytes = file.size_bytes;
+        entry.mtime_ms = file.mtime_ms;
+        if(file.hash.size() == digest_size) {
+            copyDigest(entry.hash, file.hash);
+            entry.flags |= Entry::HAS_HASH;
+        }
+        if(file.partial_hash.size() == digest_size) {
+            copyDigest(entry.partial_hash, file.partial_hash);
+            entry.flags |= Entry::HAS_PARTIAL_HASH;
+        }
+        entry.path_offset = string_pool.size();
+        entry.path_len = pending[i].relative_path.size();
+        string_pool += pending[i].relative_path;
+    }
+
+    Header header;
+    std::memset(&header, 0, sizeof(Header));
+    std::memcpy(header.magic, kMagic, sizeof(kMagic));
+    header.version = kVersion;
+    header.entry_count = entries.size();
+    header.entries_offset = sizeof(Header);
+    header.strings_offset = header.entries_offset + entries.size() * sizeof(Entry);
+    header.strings_size = string_pool.size();
+    header.root_offset = 0;
+    header.root_len = root_utf8.size();
+    header.volume_offset = root_utf8.size();
+    header.volume_len = volume_utf8.size();
+    header.created_ms = QDateTime::currentMSecsSinceEpoch();
+
+    QFile out(catalog_path);
+    if(!out.open(QIODevice::WriteOnly | QIODevice::Truncate)) {
+        qWarning() << "Failed creating catalog" << catalog_path << ":" << out.errorString();
+        return false;
+    }
+    bool written = out.write((const char*)&header, sizeof(Header)) == sizeof(Header)
+            && out.write((const char*)entries.constData(), entries.size() * sizeof(Entry)) == qint64(entries.size() * sizeof(Entry))
+            && out.write(string_pool) == string_pool.size();
+    if(!written) {
+        qWarning() << "Failed writing catalog" << catalog_path << ":" << out.errorString();
+        out.remove();
+        return false;
+    }
+    qInfo() << QString("Wrote catalog of %1 with %2 files (volume %3)").arg(root_dir.absolutePath()).arg(entries.size()).arg(QString::fromUtf8(volume_utf8));
+    return true;
+}
+
+bool HashCatalog::open(const QString& catalog_path) {
+    close();
+    catalog_file.setFileName(catalog_path);
+    if(!catalog_file.open(QIODevice::ReadOnly)) {
+        qWarning() << "Failed opening catalog" << catalog_path << ":" << catalog_file.errorString();
+        return false;
+    }
+    data_size = catalog_file.size();
+    data = data_size >= (qint64)sizeof(Header) ? catalog_file.map(0, data_size) : nullptr;
+    if(!data) {
+        qWarning() << "Failed mapping catalog" << catalog_path;
+        close();
+        return false;
+    }
+
+    // everything is validated once, accessors don't check bounds
+    auto candidate = reinterpret_cast<const Header*>(data);
+    bool valid = std::memcmp(candidate->magic, kMagic, sizeof(kMagic)) == 0
+            && candidate->version == kVersion
+            && candidate->entries_offset >= sizeof(Header)
+            && candidate->entries_offset + quint64(candidate->entry_count) * sizeof(Entry) <= candidate->strings_offset
+            && candidate->strings_offset + candidate->strings_size <= quint64(data_size)
+            && quint64(candidate->root_offset) + candidate->root_len <= candidate->strings_size
+            && quint64(candidate->volume_offset) + candidate->volume_len <= candidate->strings_size
+            && candidate->entries_offset % alignof(Entry) == 0;
+    auto candidate_entries = reinterpret_cast<const Entry*>(data + (valid ? candidate->entries_offset : 0));
+    for(quint32 i = 0; valid && i < candidate->entry_count; i++) {
+        valid = quint64(candidate_entries[i].path_offset) + candidate_entries[i].path_len <= candidate->strings_size;
+    }
+    if(!valid) {
+        qWarning() << catalog_path << "is not a valid catalog";
+        close();
+        return false;
+    }
+
+    header = candidate;
+    entries = candidate_entries;
+    strings = reinterpret_cast<const char*>(data + header->strings_offset);
+    root_path = string(header->root_offset, header->root_len);
+    root_dir = QDir(root_path);
+    return true;
+}
+
+void HashCatalog::close() {
+    if(data) {
+        catalog_file.unmap(const_cast<uchar*>(data));
+    }
+    catalog_file.close();
+    data = nullptr;
+    data_size = 0;
+    header = nullptr;
+    entries = nullptr;
+    strings = nullptr;
+    root_path.clear();
+    root_dir = QDir();
+}
+
+QString HashCatalog::string(quint32 offset, quint32 len) const {
+    return QString::fromUtf8(strings + offset, len);
+}
+
+QString HashCatalog::volume() const {
+    return header ? string(header->volume_offset, header->volume_len) : QString();
+}
+
+QString HashCatalog::relativePath(int index) const {
+    return string(entries[index].path_offset, entries[index].path_len);
+}
+
+File HashCatalog::file(int index) const {
+    const Entry& e = entries[index];
+    File file(root_dir.filePath(relativePath(index)), e.size_bytes, e.mtime_ms);
+    file.offline = true;
+    if(e.flags & Entry::HAS_HASH) {
+        file.hash = QByteArray((const char*)e.hash, digest_size);
+    }
+    if(e.flags & Entry::HAS_PARTIAL_HASH) {
+        file.partial_hash = QByteArray((const char*)e.partial_hash, digest_size);
+    }
+    return file;
+}
@@ -0,0 +1,262 @@
+#include "index_maintenance.h"
+#include "gutils.h"
+#include "datatypes.h"
+
+#include <QSqlQuery>
+#include <QSqlError>
+#include <QFileInfo>
+#include <QDir>
+#include <QDateTime>
+#include <QStorageInfo>
+#include <QtConcurrent/QtConcurrent>
+
+namespace {
+
+// files rows checked (and deleted) per step
+const int kChunkSize = 50000;
+// ids per DELETE statement, below sqlite's default bound parameter limit
+const int kDeleteBatchSize = 500;
+
+const QStringList data_tables = {"hashes", "metadata", "thumbnails"};
+
+struct IndexedFile {
+    qint64 id;
+    QString full_path;
+    qint64 size;
+    QVariant mtime;
+};
+
+enum FileState {
+    UNCHANGED,
+    MISSING,
+    CHANGED,
+    // on an unmounted drive, kept for hash catalogs and the next mount
+    OFFLINE
+};
+
+// folders unplugged drives are usually mounted under
+const QStringList removable_mount_parents = {"/media", "/mnt", "/run/media", "/Volumes"};
+
+struct FileChecker {
+    typedef FileState result_type;
+
+    // mount points of the volumes mounted right now, except the root filesystem
+    QStringList mounted_roots;
+
+    FileChecker() {
+        for(const QStorageInfo& storage: QStorageInfo::mountedVolumes()) {
+            if(storage.isValid() && storage.isReady() && !storage.isRoot()) {
+                QString root = storage.rootPath();
+                mounted_roots.append(root.endsWith('/') ? root : root + '/');
+            }
+        }
+    }
+
+    bool isOnUnmountedVolume(const QString& full_path) const {
+        // the volume is there, so the file (or its folder) was deleted
+        for(auto& root: mounted_roots) {
+            if(full_path.startsWith(root)) {
+                return false;
+            }
+        }
+
+        QString ancestor = QFileInfo(full_path).path();
+        while(!QFileInfo::exists(ancestor)) {
+            QString parent = QFileInfo(ancestor).path();
+            // not even the drive is there (windows drive letters)
+            if(parent == ancestor) {
+                return true;
+            }
+            ancestor = parent;
+        }
+        QStorageInfo storage(ancestor);
+        if(!storage.isValid() || !storage.isReady()) {
+            return true;
+        }
+        // the path ends on the root filesystem, at the empty mount point left behind by the drive
+        // or in a folder drives are mounted under
+        return QDir(ancestor).isEmpty() || removable_mount_parents.contains(ancestor) ||
+               removable_mount_parents.contains(QFileInfo(ancestor).path());
+    }
+
+    FileState operator()(const IndexedFile& file) const {
+        QFileInfo info(file.full_path);
+        if(!info.exists()) {
+            return isOnUnmountedVolume(file.full_path) ? OFFLINE : MISSING;
+        }
+        // same rule as for cached data lookups
+        if(info.size() != file.size || (!file.mtime.isNull() && info.lastModified().toMSecsSinceEpoch() != file.mtime.toLongLong())) {
+            return CHANGED;
+        }
+        return UNCHANGED;
+    }
+};
+
+qint64 pragmaValue(QSqlDatabase db, const QString& pragma) {
+    QSqlQuery query(db);
+    if(query.exec("PRAGMA " + pragma) && query.first()) {
+        return query.value(0).toLongLong();
+    }
+    return -1;
+}
+
+qint64 dbSize(QSqlDatabase db) {
+    return pragmaValue(db, "page_count") * pragmaValue(db, "page_size");
+}
+
+bool deleteFiles(QSqlDatabase db, const QVector<qint64>& ids) {
+    db.transaction();
+    for(int start = 0; start < ids.size(); start += kDeleteBatchSize) {
+        int count = qMin(kDeleteBatchSize, ids.size() - start);
+        QString placeholders = QString("?,").repeated(count);
+        placeholders.chop(1);
+
+        QStringList statements;
+        for(auto& table: data_tables) {
+            statements.append(QString("DELETE FROM %1 WHERE file_id IN (%2)").arg(table, placeholders));
+        }
+        statements.append(QString("DELETE FROM files WHERE id IN (%1)").arg(placeholders));
+
+        for(auto& statement: statements) {
+            QSqlQuery query(db);
+            query.prepare(statement);
+            for(int i = 0; i < count; i++) {
+                query.bindValue(i, ids[start + i]);
+            }
+            if(!DbUtils::execQuery(query)) {
+                db.rollback();
+                return false;
+            }
+        }
+    }
+    return db.commit();
+}
+
+void measureTables(QSqlDatabase db, IndexMaintenance::Report& report) {
+    report.table_sizes.clear();
+
+    // dbstat is only there if sqlite was built with it
+    QSqlQuery query(db);
+    if(query.exec("SELECT name, SUM(pgsize) FROM dbstat GROUP BY name ORDER BY 2 DESC")) {
+        report.table_sizes_in_bytes = true;
+        while(query.next()) {
+            report.table_sizes.append({query.value(0).toString(), query.value(1).toLongLong()});
+        }
+        return;
+    }
+
+    report.table_sizes_in_bytes = false;
+    for(auto& table: QStringList{"directories", "files"} + data_tables) {
+        QSqlQuery count_query(db);
+        if(count_query.exec("SELECT COUNT(*) FROM " + table) && count_query.first()) {
+            report.table_sizes.append({table, count_query.value(0).toLongLong()});
+        }
+    }
+}
+
+}
+
+IndexMaintenance::Report IndexMaintenance::run(QSqlDatabase db, const std::function<void(const QString&)>& status_callback, bool allow_full_vacuum) {
+    Report report;
+    report.db_size_before = dbSize(db);
+    const FileChecker check_file;
+
+    // walk the index in id order, the existence checks of every chunk run in parallel
+    qint64 last_id = -1;
+    for(;;) {
+        QVector<IndexedFile> files;
+        {
+            QSqlQuery query(db);
+            query.setForwardOnly(true);
+            query.prepare("SELECT f.id, d.path, f.name, f.size, f.mtime FROM files f JOIN directories d ON d.id = f.dir_id "
+                          "WHERE f.id > ? ORDER BY f.id LIMIT ?");
+            query.bindValue(0, last_id);
+            query.bindValue(1, kChunkSize);
+            DbUtils::execQuery(query);
+            while(query.next()) {
+                files.append({query.value(0).toLongLong(),
+                              QDir(query.value(1).toString()).filePath(query.value(2).toString()),
+                              query.value(3).toLongLong(), query.value(4)});
+            }
+        }
+        if(files.isEmpty()) {
+            break;
+        }
+        last_id = files.last().id;
+
+        status_callback(QString("Checking indexed files: %1").arg(files.first().full_path));
+        QVector<FileState> states = QtConcurrent::blockingMapped<QVector<FileState>>(files, check_file);
+
+        QVector<qint64> stale_ids;
+        for(int i = 0; i < files.size(); i++) {
+            if(states[i] == MISSING) {
+                report.missing_files ++;
+                stale_ids.append(files[i].id);
+            } else if(states[i] == CHANGED) {
+                report.changed_files ++;
+                stale_ids.append(files[i].id);
+            } else if(states[i] == OFFLINE) {
+                report.offline_files ++;
+            }
+        }
+        report.checked_files += files.size();
+
+        if(!stale_ids.isEmpty() && !deleteFiles(db, stale_ids)) {
+            qCritical() << "Failed pruning index entries:" << db.lastError();
+            break;
+        }
+    }
+
+    status_callback("Removing empty directories from index");
+    QSqlQuery remove_dirs(db);
+    if(remove_dirs.exec("DELETE FROM directories WHERE id NOT IN (SELECT dir_id FROM files)")) {
+        report.removed_directories = remove_dirs.numRowsAffected();
+    }
+
+    // incremental vacuum needs auto_vacuum, switching to it needs one full vacuum
+    status_callback("Compacting index");
+    if(pragmaValue(db, "auto_vacuum") != 2) {
+        if(allow_full_vacuum) {
+            status_callback("Compacting index (rewrites the whole index once)");
+            DbUtils::execQuery(db, "PRAGMA auto_vacuum = INCREMENTAL");
+            DbUtils::execQuery(db, "VACUUM");
+        } else {
+            // rewrites the whole file, which can take long and needs as much free space, so it's only done on request
+            qInfo() << "Index not compacted, run the Index maintenance mode once to enable compacting";
+        }
+    } else {
+        QSqlQuery vacuum(db);
+        // returns a row per freed page
+        vacuum.setForwardOnly(true);
+        if(vacuum.exec("PRAGMA incremental_vacuum")) {
+            while(vacuum.next()) {}
+        }
+    }
+    DbUtils::execQuery(db, "PRAGMA wal_checkpoint(TRUNCATE)");
+
+    measureTables(db, report);
+    report.db_size_after = dbSize(db);
+    return report;
+}
+
+QString IndexMaintenance::Report::toString() const {
+    QString str = QString("Checked %1 indexed files: %2 missing, %3 changed (pruned), %4 offline (kept), %5 empty directories removed\n")
+            .arg(checked_files).arg(missing_files).arg(changed_files).arg(offline_files).arg(removed_directories);
+    str += QString("Index size: %1 -> %2\n").arg(FileUtils::bytesToReadable(db_size_before), FileUtils::bytesToReadable(db_size_after));
+
+    str += table_sizes_in_bytes ? "Space per table/index:\n" : "Rows per table:\n";
+    for(auto& table_size: table_sizes) {
+        str += QString("    %1: %2\n").arg(table_size.first, table_sizes_in_bytes ? FileUtils::bytesToReadable(table_size.second)
+                                                                                 : QString::number(table_size.second));
+    }
+
+    str += "Cache hit ratio since start:\n";
+    const QList<QPair<QString, const CacheHitCounter*>> counters = {
+        {"hashes", &File::hash_cache}, {"metadata", &File::metadata_cache}, {"thumbnails", &File::thumbnail_cache}
+    };
+    for(auto& counter: counters) {
+        str += QString("    %1: %2% (%3 hits, %4 misses)\n").arg(counter.first).arg(counter.second->hitRatio() * 100, 0, 'f', 1)
+                .arg(counter.second->hits.loadRelaxed()).arg(counter.second->misses.loadRelaxed());
+    }
+    return str;
+}
@@ -0,0 +1,301 @@
+#include "index_watcher.h"
+#include "db_writer.h"
+#include "constants.h"
+#include "db_connection_pool.h"
+
+#include <QtConcurrent/QtConcurrent>
+#include <QFileInfo>
+#include <QDir>
+#include <QSqlQuery>
+#include <QDebug>
+
+#include <sys/inotify.h>
+#include <unistd.h>
+#include <cerrno>
+#include <cstring>
+
+namespace {
+
+// hard links only report IN_CREATE, files written in place IN_CLOSE_WRITE
+const uint32_t kWatchMask = IN_CREATE | IN_CLOSE_WRITE | IN_MOVED_TO | IN_MOVED_FROM | IN_DELETE | IN_ONLYDIR | IN_EXCL_UNLINK;
+
+}
+
+IndexWatcher::IndexWatcher(DbWriter* db_writer) : db_writer(db_writer) {
+    quiet_timer.setSingleShot(true);
+    connect(&quiet_timer, SIGNAL(timeout()), this, SLOT(processQueue()));
+    connect(&batch_watcher, SIGNAL(finished()), this, SLOT(onBatchFinished()));
+}
+
+IndexWatcher::~IndexWatcher() {
+    stop();
+}
+
+bool IndexWatcher::start(const QStringList& roots, const QStringList& blacklisted_dirs,
+                         const QStringList& extensions, FileUtils::ExtenstionFilterState filter_state) {
+    stop();
+
+    inotify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if(inotify_fd == -1) {
+        qCritical() << "Failed starting the folder watcher:" << strerror(errno);
+        return false;
+    }
+    this->roots = roots;
+    this->blacklisted_dirs = blacklisted_dirs;
+    this->extensions = extensions;
+    this->filter_state = filter_state;
+
+    notifier.reset(new QSocketNotifier(inotify_fd, QSocketNotifier::Read));
+    connect(notifier.get(), SIGNAL(activated(int)), this, SLOT(readEvents()));
+
+    for(const auto& root: roots) {
+        watchTree(QDir(root).absolutePath(), false);
+    }
+    qInfo() << "Watching" << dir_paths.size() << "folders under" << roots;
+    return true;
+}
+
+void IndexWatcher::stop() {
+    if(inotify_fd == -1) {
+        return;
+    }
+    // what was already noticed still goes into the index
+    flush();
+
+    notifier.reset();
+    close(inotify_fd);
+    inotify_fd = -1;
+    dir_paths.clear();
+    roots.clear();
+}
+
+void IndexWatcher::watchTree(const QString& dir, bool queue_files) {
+    int watch = inotify_add_watch(inotify_fd, QFile::encodeName(dir).constData(), kWatchMask);
+    if(watch == -1) {
+        if(errno == ENOSPC) {
+            qWarning() << "Out of inotify watches, raise fs.inotify.max_user_watches to watch" << dir;
+        } else {
+            qWarning() << "Failed watching" << dir << ":" << strerror(errno);
+        }
+        return;
+    }
+    dir_paths.insert(watch, dir);
+
+    QDir directory(dir);
+    directory.setFilter(QDir::Dirs | QDir::Files | QDir::NoDotAndDotDot | QDir::NoSymLinks);
+    for(const auto& file_or_folder: directory.entryInfoList()) {
+        if(file_or_folder.isFile()) {
+            if(queue_files && FileUtils::passesExtensionFilter(file_or_folder.fileName(), extensions, filter_state)) {
+                removed_files.remove(file_or_folder.absoluteFilePath());
+                changed_files.insert(file_or_folder.absoluteFilePath());
+            }
+        } else if(file_or_folder.isDir() && !blacklisted_dirs.contains(file_or_folder.absoluteFilePath())) {
+            watchTree(file_or_folder.absoluteFilePath(), queue_files);
+        }
+    }
+}
+
+void IndexWatcher::unwatchTree(const QString& dir) {
+    for(auto it = dir_paths.begin(); it != dir_paths.end();) {
+        if(it.value() == dir || it.value().startsWith(dir + '/')) {
+            inotify_rm_watch(inotify_fd, it.key());
+            it = dir_paths.erase(it);
+        } else {
+            it++;
+        }
+    }
+}
+
+void IndexWatcher::queueIndexedRemovals(const QString& dir) {
+    // entries of files hashed a moment ago may still be queued in the writer
+    db_writer->flush();
+
+    QString prefix = dir + '/';
+    // '0' follows '/', so this covers everything starting with prefix
+    QString prefix_end = dir + '0';
+    QSqlQuery query(DbConnectionPool::reader());
+    query.prepare("SELECT d.path, f.name FROM files f JOIN directories d ON d.id = f.dir_id "
+                  "WHERE d.path = ? OR (d.path >= ? AND d.path < ?)");
+    query.bindValue(0, dir);
+    query.bindValue(1, prefix);
+    query.bindValue(2, prefix_end);
+    DbUtils::execQuery(query);
+    while(query.next()) {
+        QString path = QDir(query.value(0).toString()).filePath(query.value(1).toString());
+        changed_files.remove(path);
+        removed_files.insert(path);
+    }
+}
+
+void IndexWatcher::rescan() {
+    // the kernel doesn't say which folders lost events, so all of them are walked,
+    // files that didn't change are found in the index and cost only a lookup
+    qWarning() << "Folder watcher missed events, rescanning" << roots;
+    for(const auto& root: roots) {
+        watchTree(QDir(root).absolutePath(), true);
+    }
+}
+
+void IndexWatcher::readEvents() {
+    alignas(inotify_event) char buffer[64 * 1024];
+    bool overflowed = false;
+
+    for(;;) {
+        ssize_t length = read(inotify_fd, buffer, sizeof(buffer));
+        if(length <= 0) {
+            // EAGAIN, everything was read
+            break;
+        }
+        for(char* position = buffer; position < buffer + length;) {
+            const inotify_event* event = reinterpret_cast<const inotify_event*>(position);
+            position += sizeof(inotify_event) + event->len;
+
+            if(event->mask & IN_Q_OVERFLOW) {
+                overflowed = true;
+                continue;
+            }
+            auto dir = dir_paths.constFind(event->wd);
+            if(dir == dir_paths.constEnd()) {
+                continue;
+            }
+            // the folder was deleted (or unwatched), its files were reported one by one
+            if(event->mask & IN_IGNORED) {
+                dir_paths.erase(dir);
+                continue;
+            }
+            // events of the folder itself (unmounted)
+            if(event->len == 0) {
+                continue;
+            }
+
+            QString name = QFile::decodeName(event->name);
+            QString path = dir.value() + '/' + name;
+            if(event->mask & IN_ISDIR) {
+                // a moved in folder is new to the watcher, its files are queued as well
+                if(event->mask & (IN_CREATE | IN_MOVED_TO)) {
+                    if(!blacklisted_dirs.contains(path)) {
+                        watchTree(path, true);
+                    }
+                } else if(event->mask & IN_MOVED_FROM) {
+                    // if it was only renamed, IN_MOVED_TO queues its files under the new path
+                    unwatchTree(path);
+                    queueIndexedRemovals(path);
+                }
+                continue;
+            }
+
+            if(!FileUtils::passesExtensionFilter(name, extensions, filter_state)) {
+                continue;
+            }
+            if(event->mask & (IN_CREATE | IN_CLOSE_WRITE | IN_MOVED_TO)) {
+                removed_files.remove(path);
+                changed_files.insert(path);
+            } else if(event->mask & (IN_DELETE | IN_MOVED_FROM)) {
+                changed_files.remove(path);
+                removed_files.insert(path);
+            }
+        }
+    }
+
+    if(overflowed) {
+        rescan();
+    }
+    // restarted on every change, the queue is processed once things calm down (or max_delay_ms after the first change)
+    if(queuedFiles() > 0 && !paused) {
+        if(!pending_since.isValid()) {
+            pending_since.start();
+        }
+        quiet_timer.start((int)qBound<qint64>(0, max_delay_ms - pending_since.elapsed(), quiet_period_ms));
+    }
+}
+
+void IndexWatcher::processQueue() {
+    // the next batch starts when the current one is saved
+    if(paused || batch_watcher.isRunning()) {
+        return;
+    }
+    pending_since.invalidate();
+
+    for(const auto& path: removed_files) {
+        // replaced by a new file in the meantime
+        if(QFileInfo(path).isFile()) {
+            changed_files.insert(path);
+        } else {
+            File(path, 0, 0).removeFromDb(db_writer);
+        }
+    }
+    removed_files.clear();
+
+    batch.clear();
+    for(const auto& path: changed_files) {
+        if(QFileInfo(path).isFile()) {
+            batch.append({File(path)});
+        } else {
+            File(path, 0, 0).removeFromDb(db_writer);
+        }
+    }
+    changed_files.clear();
+
+    if(batch.isEmpty()) {
+        return;
+    }
+    batch_watcher.setFuture(QtConcurrent::map(batch, [](ChangedFile& changed) {
+        // a cached entry has both hashes, so an unchanged file costs one lookup
+        changed.hashed = changed.file.loadHashBlocking(File::PARTIAL);
+        changed.hashed = changed.file.loadHashBlocking(File::FULL) || changed.hashed;
+        // metadata of a modified file was invalidated together with its hashes
+        if(changed.hashed) {
+            changed.metadata_read = changed.file.loadMetadataNative(Constants::datetime_format);
+        }
+    }));
+}
+
+void IndexWatcher::saveBatch() {
+    // the batch belongs to the thread pool until it's finished
+    if(!batch_watcher.isFinished() || batch.isEmpty()) {
+        return;
+    }
+    int updated = 0;
+    for(auto& changed: batch) {
+        if(changed.hashed) {
+            changed.file.saveHashToDb(db_writer);
+            updated ++;
+        }
+        if(changed.metadata_read) {
+            changed.file.saveMetadataToDb(db_writer);
+        }
+    }
+    qInfo() << "Folder watcher updated" << updated << "of" << batch.size() << "changed files";
+    batch.clear();
+}
+
+void IndexWatcher::onBatchFinished() {
+    saveBatch();
+    // changes that came in while hashing wait for their own quiet period
+    if(!quiet_timer.isActive()) {
+        processQueue();
+    }
+}
+
+void IndexWatcher::flush() {
+    quiet_timer.stop();
+    batch_watcher.waitForFinished();
+    saveBatch();
+    processQueue();
+    batch_watcher.waitForFinished();
+    saveBatch();
+    db_writer->flush();
+}
+
+void IndexWatcher::pause() {
+    flush();
+    paused = true;
+}
+
+void IndexWatcher::resume() {
+    paused = false;
+    if(queuedFiles() > 0) {
+        pending_since.start();
+        quiet_timer.start(quiet_period_ms);
+    }
+}
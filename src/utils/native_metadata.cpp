@@ -0,0 +1,604 @@
+#include "native_metadata.h"
+
+#include <QFile>
+#include <QFileInfo>
+#include <QDateTime>
+
+namespace {
+
+// seconds between 1904-01-01 (QuickTime epoch) and 1970-01-01
+const qint64 kQuickTimeEpochOffset = 2082844800;
+
+// largest moov box / PNG chunk we are willing to load
+const qint64 kMaxMoovSize = 64 * 1024 * 1024;
+const qint64 kMaxChunkSize = 1024 * 1024;
+
+// byte sizes of TIFF field types (index = type)
+const int tiff_type_sizes[] = {0, 1, 1, 2, 4, 8, 1, 1, 2, 4, 8, 4, 8};
+
+enum TiffTag : quint16 {
+    TAG_MAKE = 0x010F,
+    TAG_MODEL = 0x0110,
+    TAG_ARTIST = 0x013B,
+    TAG_EXIF_IFD = 0x8769,
+    TAG_DATETIME_ORIGINAL = 0x9003,
+    TAG_EXIF_IMAGE_WIDTH = 0xA002,
+    TAG_EXIF_IMAGE_HEIGHT = 0xA003
+};
+
+// QuickTime udta / iTunes ilst text items
+const QMap<QByteArray, QString> quicktime_text_tags = {
+    {"\xA9" "mak", "Make"},
+    {"\xA9" "mod", "Model"},
+    {"\xA9" "nam", "Title"},
+    {"\xA9" "ART", "Artist"},
+    {"\xA9" "alb", "Album"},
+    {"\xA9" "gen", "Genre"}
+};
+
+// major brands of ISO-BMFF files we know to be mp4 videos
+const QList<QByteArray> mp4_brands = {"isom", "iso2", "iso4", "iso5", "iso6", "mp41", "mp42",
+                                      "avc1", "dash", "mmp4", "MSNV", "XAVC", "f4v "};
+
+// APP1 segment / PNG text keyword of an XMP packet
+const QByteArray kJpegXmpSignature("http://ns.adobe.com/xap/1.0/\0", 29);
+const QByteArray kPngXmpKeyword("XML:com.adobe.xmp\0", 18);
+
+// top-level boxes a QuickTime file without ftyp can start with
+const QList<QByteArray> quicktime_first_boxes = {"moov", "mdat", "wide", "free", "skip", "pnot"};
+
+// bounds-checked reader over a byte buffer
+struct ByteReader {
+    const QByteArray& data;
+    bool little_endian = false;
+
+    bool has(qint64 offset, qint64 len) const {
+        return offset >= 0 && len >= 0 && offset + len <= data.size();
+    }
+
+    quint8 u8(qint64 offset) const {
+        return static_cast<quint8>(data.at(offset));
+    }
+
+    quint16 u16(qint64 offset) const {
+        quint16 b0 = u8(offset);
+        quint16 b1 = u8(offset + 1);
+        return little_endian ? (b1 << 8 | b0) : (b0 << 8 | b1);
+    }
+
+    quint32 u32(qint64 offset) const {
+        quint32 w0 = u16(offset);
+        quint32 w1 = u16(offset + 2);
+        return little_endian ? (w1 << 16 | w0) : (w0 << 16 | w1);
+    }
+
+    quint64 u64(qint64 offset) const {
+        quint64 d0 = u32(offset);
+        quint64 d1 = u32(offset + 4);
+        return little_endian ? (d1 << 32 | d0) : (d0 << 32 | d1);
+    }
+};
+
+struct Box {
+    QByteArray type;
+    qint64 data_offset;
+    qint64 data_size;
+};
+
+void insertTag(QMap<QString, QString>& tags, const QString& name, const QString& value) {
+    // first occurrence wins
+    if(!value.isEmpty() && !tags.contains(name)) {
+        tags.insert(name, value);
+    }
+}
+
+QString cleanString(const QByteArray& raw) {
+    int end = raw.indexOf('\0');
+    return QString::fromUtf8(end == -1 ? raw : raw.left(end)).trimmed();
+}
+
+// exif dates are "YYYY:MM:DD HH:MM:SS", anything else is ignored
+QString cleanDate(const QByteArray& raw) {
+    QString date = cleanString(raw).left(19);
+    if(date.size() != 19 || date[4] != ':' || date[7] != ':' || date[10] != ' ' || date[13] != ':' || date[16] != ':') {
+        return "";
+    }
+    return date;
+}
+
+QString quickTimeDate(quint64 seconds) {
+    if(seconds == 0) {
+        return "";
+    }
+    return QDateTime::fromSecsSinceEpoch(static_cast<qint64>(seconds) - kQuickTimeEpochOffset, Qt::UTC)
+            .toString("yyyy:MM:dd HH:mm:ss");
+}
+
+// same output as exiftool's ConvertDuration
+QString formatDuration(double seconds) {
+    if(seconds <= 0) {
+        return "0 s";
+    }
+    if(seconds < 30) {
+        return QString::asprintf("%.2f s", seconds);
+    }
+    seconds += 0.5;
+    quint64 hours = seconds / 3600;
+    seconds -= hours * 3600;
+    quint64 minutes = seconds / 60;
+    seconds -= minutes * 60;
+    QString days;
+    if(hours > 24) {
+        quint64 d = hours / 24;
+        hours -= d * 24;
+        days = QString("%1 days ").arg(d);
+    }
+    return days + QString::asprintf("%d:%.2d:%.2d", (int)hours, (int)minutes, (int)seconds);
+}
+
+#pragma region TIFF / EXIF {
+
+quint32 tiffInt(const ByteReader& r, quint16 type, qint64 offset) {
+    switch(type) {
+        case 3:
+            return r.u16(offset);
+        case 4:
+            return r.u32(offset);
+        default:
+            return 0;
+    }
+}
+
+void parseIfd(const ByteReader& r, qint64 ifd_offset, QMap<QString, QString>& tags, int depth) {
+    if(depth > 1 || !r.has(ifd_offset, 2)) {
+        return;
+    }
+    int entries = r.u16(ifd_offset);
+    if(!r.has(ifd_offset + 2, entries * 12)) {
+        return;
+    }
+    for(int i = 0; i < entries; i++) {
+        qint64 entry = ifd_offset + 2 + i * 12;
+        quint16 tag = r.u16(entry);
+        quint16 type = r.u16(entry + 2);
+        quint32 count = r.u32(entry + 4);
+        if(type == 0 || type > 12 || count == 0) {
+            continue;
+        }
+        qint64 value_size = (qint64)tiff_type_sizes[type] * count;
+        // values that fit into 4 bytes are stored inline
+        qint64 value_offset = value_size <= 4 ? entry + 8 : r.u32(entry + 8);
+        if(!r.has(value_offset, value_size)) {
+            continue;
+        }
+        switch(tag) {
+            case TAG_MAKE:
+                insertTag(tags, "Make", cleanString(r.data.mid(value_offset, value_size)));
+                break;
+            case TAG_MODEL:
+                insertTag(tags, "Model", cleanString(r.data.mid(value_offset, value_size)));
+                break;
+            case TAG_ARTIST:
+                insertTag(tags, "Artist", cleanString(r.data.mid(value_offset, value_size)));
+                break;
+            case TAG_DATETIME_ORIGINAL:
+                insertTag(tags, "DateTimeOriginal", cleanDate(r.data.mid(value_offset, value_size)));
+                break;
+            case TAG_EXIF_IMAGE_WIDTH:
+                insertTag(tags, "ExifImageWidth", QString::number(tiffInt(r, type, value_offset)));
+                break;
+            case TAG_EXIF_IMAGE_HEIGHT:
+                insertTag(tags, "ExifImageHeight", QString::number(tiffInt(r, type, value_offset)));
+                break;
+            case TAG_EXIF_IFD:
+                parseIfd(r, tiffInt(r, type, value_offset), tags, depth + 1);
+                break;
+        }
+    }
+}
+
+void parseTiff(const QByteArray& data, QMap<QString, QString>& tags) {
+    ByteReader r {data};
+    if(!r.has(0, 8)) {
+        return;
+    }
+    if(data.startsWith("II")) {
+        r.little_endian = true;
+    } else if(!data.startsWith("MM")) {
+        return;
+    }
+    if(r.u16(2) != 42) {
+        return;
+    }
+    parseIfd(r, r.u32(4), tags, 0);
+}
+
+#pragma endregion}
+
+#pragma region JPEG {
+
+bool readJpeg(QFile& file, QMap<QString, QString>& tags, bool& has_xmp) {
+    file.seek(2);
+    for(;;) {
+        QByteArray header = file.read(2);
+        if(header.size() != 2 || static_cast<quint8>(header[0]) != 0xFF) {
+            return false;
+        }
+        quint8 marker = header[1];
+        if(marker == 0xFF) {
+            // fill byte
+            file.seek(file.pos() - 1);
+            continue;
+        }
+        if(marker == 0x01 || (marker >= 0xD0 && marker <= 0xD7)) {
+            // markers without payload
+            continue;
+        }
+        if(marker == 0xDA || marker == 0xD9) {
+            // start of scan, everything we need is in front of it
+            return tags.contains("ImageWidth");
+        }
+
+        QByteArray length_raw = file.read(2);
+        ByteReader length_reader {length_raw};
+        if(!length_reader.has(0, 2) || length_reader.u16(0) < 2) {
+            return false;
+        }
+        qint64 segment_size = length_reader.u16(0) - 2;
+        qint64 segment_start = file.pos();
+
+        if(marker == 0xE1) {
+            QByteArray segment = file.read(segment_size);
+            if(segment.startsWith(QByteArray("Exif\0\0", 6))) {
+                parseTiff(segment.mid(6), tags);
+            } else if(segment.startsWith(kJpegXmpSignature)) {
+                has_xmp = true;
+            }
+        } else if(marker >= 0xC0 && marker <= 0xCF && marker != 0xC4 && marker != 0xC8 && marker != 0xCC) {
+            // start of frame: precision, height, width
+            QByteArray frame = file.read(5);
+            ByteReader r {frame};
+            if(r.has(0, 5)) {
+                insertTag(tags, "ImageHeight", QString::number(r.u16(1)));
+                insertTag(tags, "ImageWidth", QString::number(r.u16(3)));
+            }
+        }
+
+        if(!file.seek(segment_start + segment_size)) {
+            return false;
+        }
+    }
+}
+
+#pragma endregion}
+
+#pragma region PNG {
+
+void parsePngText(const QByteArray& type, const QByteArray& data, QMap<QString, QString>& tags) {
+    int keyword_end = data.indexOf('\0');
+    if(keyword_end == -1 || data.left(keyword_end) != "Title") {
+        return;
+    }
+    if(type == "tEXt") {
+        insertTag(tags, "Title", QString::fromLatin1(data.mid(keyword_end + 1)).trimmed());
+        return;
+    }
+    // iTXt: compression flag, compression method, language, translated keyword, text
+    if(data.size() < keyword_end + 3 || data[keyword_end + 1] != 0) {
+        return;
+    }
+    int language_end = data.indexOf('\0', keyword_end + 3);
+    int translated_end = language_end == -1 ? -1 : data.indexOf('\0', language_end + 1);
+    if(translated_end != -1) {
+        insertTag(tags, "Title", QString::fromUtf8(data.mid(translated_end + 1)).trimmed());
+    }
+}
+
+bool readPng(QFile& file, QMap<QString, QString>& tags, bool& has_xmp) {
+    bool got_header = false;
+    qint64 pos = 8;
+    while(file.seek(pos)) {
+        QByteArray header = file.read(8);
+        ByteReader r {header};
+        if(!r.has(0, 8)) {
+            break;
+        }
+        qint64 length = r.u32(0);
+        QByteArray type = header.mid(4, 4);
+
+        if(type == "IHDR" && length >= 8) {
+            QByteArray data = file.read(8);
+            ByteReader d {data};
+            if(d.has(0, 8)) {
+                insertTag(tags, "ImageWidth", QString::number(d.u32(0)));
+                insertTag(tags, "ImageHeight", QString::number(d.u32(4)));
+                got_header = true;
+            }
+        } else if(type == "eXIf" && length <= kMaxChunkSize) {
+            parseTiff(file.read(length), tags);
+        } else if((type == "tEXt" || type == "iTXt") && length <= kMaxChunkSize) {
+            QByteArray data = file.read(length);
+            has_xmp = has_xmp || (type == "iTXt" && data.startsWith(kPngXmpKeyword));
+            parsePngText(type, data, tags);
+        } else if(type == "IEND") {
+            break;
+        }
+        // skip data and crc
+        pos += 8 + length + 4;
+    }
+    return got_header;
+}
+
+#pragma endregion}
+
+#pragma region ISO-BMFF (MP4 / MOV) {
+
+bool nextBox(const ByteReader& r, qint64& pos, qint64 end, Box& box) {
+    if(pos + 8 > end || !r.has(pos, 8)) {
+        return false;
+    }
+    quint64 size = r.u32(pos);
+    qint64 header_size = 8;
+    if(size == 1) {
+        if(!r.has(pos, 16)) {
+            return false;
+        }
+        size = r.u64(pos + 8);
+        header_size = 16;
+    } else if(size == 0) {
+        // box extends to the end of its parent
+        size = end - pos;
+    }
+    if(size < (quint64)header_size || pos + (qint64)size > end) {
+        return false;
+    }
+    box = {r.data.mid(pos + 4, 4), pos + header_size, (qint64)size - header_size};
+    pos += size;
+    return true;
+}
+
+// creation date, timescale and duration of mvhd / mdhd boxes
+bool parseTimeBox(const ByteReader& r, const Box& box, quint64& created, quint64& timescale, quint64& duration) {
+    qint64 o = box.data_offset;
+    if(box.data_size < 4) {
+        return false;
+    }
+    if(r.u8(o) == 1) {
+        if(box.data_size < 32) {
+            return false;
+        }
+        created = r.u64(o + 4);
+        timescale = r.u32(o + 20);
+        duration = r.u64(o + 24);
+    } else {
+        if(box.data_size < 20) {
+            return false;
+        }
+        created = r.u32(o + 4);
+        timescale = r.u32(o + 12);
+        duration = r.u32(o + 16);
+    }
+    return true;
+}
+
+void parseTrak(const ByteReader& r, const Box& trak, QMap<QString, QString>& tags) {
+    qint64 pos = trak.data_offset;
+    qint64 end = trak.data_offset + trak.data_size;
+    Box box;
+    while(nextBox(r, pos, end, box)) {
+        if(box.type == "tkhd") {
+            // width and height (16.16 fixed point) are at the end of the box
+            qint64 o = box.data_offset;
+            qint64 dimensions_offset = box.data_size >= 4 && r.u8(o) == 1 ? 88 : 76;
+            if(box.data_size >= dimensions_offset + 8) {
+                quint32 width = r.u32(o + dimensions_offset) >> 16;
+                quint32 height = r.u32(o + dimensions_offset + 4) >> 16;
+                if(width && height) {
+                    insertTag(tags, "ImageWidth", QString::number(width));
+                    insertTag(tags, "ImageHeight", QString::number(height));
+                }
+            }
+        } else if(box.type == "mdia") {
+            qint64 mdia_pos = box.data_offset;
+            qint64 mdia_end = box.data_offset + box.data_size;
+            Box mdia_box;
+            while(nextBox(r, mdia_pos, mdia_end, mdia_box)) {
+                quint64 created, timescale, duration;
+                if(mdia_box.type == "mdhd" && parseTimeBox(r, mdia_box, created, timescale, duration)) {
+                    insertTag(tags, "MediaCreateDate", quickTimeDate(created));
+                    if(timescale) {
+                        insertTag(tags, "MediaDuration", formatDuration(duration / (double)timescale));
+                    }
+                }
+            }
+        }
+    }
+}
+
+void parseIlst(const ByteReader& r, const Box& ilst, QMap<QString, QString>& tags) {
+    qint64 pos = ilst.data_offset;
+    qint64 end = ilst.data_offset + ilst.data_size;
+    Box item;
+    while(nextBox(r, pos, end, item)) {
+        if(!quicktime_text_tags.contains(item.type)) {
+            continue;
+        }
+        qint64 item_pos = item.data_offset;
+        Box data;
+        // data box: type (4), locale (4), value
+        if(nextBox(r, item_pos, item.data_offset + item.data_size, data) && data.type == "data" && data.data_size > 8) {
+            insertTag(tags, quicktime_text_tags[item.type], cleanString(r.data.mid(data.data_offset + 8, data.data_size - 8)));
+        }
+    }
+}
+
+// keys (QuickTime metadata keys, e.g. Apple's ContentCreateDate) and XMP are not parsed, has_unparsed is set instead
+void parseMeta(const ByteReader& r, const Box& meta, QMap<QString, QString>& tags, bool& has_unparsed) {
+    qint64 pos = meta.data_offset;
+    // mp4 meta is a full box (version + flags), QuickTime meta is not
+    if(meta.data_size >= 4 && r.u32(pos) == 0) {
+        pos += 4;
+    }
+    qint64 end = meta.data_offset + meta.data_size;
+    Box box;
+    while(nextBox(r, pos, end, box)) {
+        if(box.type == "ilst") {
+            parseIlst(r, box, tags);
+        } else if(box.type == "keys") {
+            has_unparsed = true;
+        }
+    }
+}
+
+void parseUdta(const ByteReader& r, const Box& udta, QMap<QString, QString>& tags, bool& has_unparsed) {
+    qint64 pos = udta.data_offset;
+    qint64 end = udta.data_offset + udta.data_size;
+    Box box;
+    while(nextBox(r, pos, end, box)) {
+        if(box.type == "meta") {
+            parseMeta(r, box, tags, has_unparsed);
+        } else if(box.type == "XMP_") {
+            has_unparsed = true;
+        } else if(quicktime_text_tags.contains(box.type) && box.data_size >= 4) {
+            // QuickTime text item: size (2), language (2), text
+            qint64 text_size = r.u16(box.data_offset);
+            if(text_size <= box.data_size - 4) {
+                insertTag(tags, quicktime_text_tags[box.type], cleanString(r.data.mid(box.data_offset + 4, text_size)));
+            }
+        }
+    }
+}
+
+void parseMoov(const QByteArray& moov, QMap<QString, QString>& tags, bool& has_unparsed) {
+    ByteReader r {moov};
+    qint64 pos = 0;
+    Box box;
+    while(nextBox(r, pos, moov.size(), box)) {
+        quint64 created, timescale, duration;
+        if(box.type == "mvhd" && parseTimeBox(r, box, created, timescale, duration)) {
+            if(timescale) {
+                insertTag(tags, "Duration", formatDuration(duration / (double)timescale));
+            }
+        } else if(box.type == "trak") {
+            parseTrak(r, box, tags);
+        } else if(box.type == "udta") {
+            parseUdta(r, box, tags, has_unparsed);
+        } else if(box.type == "meta") {
+            parseMeta(r, box, tags, has_unparsed);
+        }
+    }
+}
+
+QString isoBmffMimeType(const QByteArray& first_box_type, const QByteArray& brand) {
+    if(first_box_type != "ftyp") {
+        return quicktime_first_boxes.contains(first_box_type) ? "video/quicktime" : "";
+    }
+    if(brand == "qt  ") {
+        return "video/quicktime";
+    }
+    if(brand.startsWith("M4A") || brand.startsWith("M4B") || brand.startsWith("M4P")) {
+        return "audio/mp4";
+    }
+    if(brand.startsWith("M4V")) {
+        return "video/x-m4v";
+    }
+    if(brand.startsWith("3g2")) {
+        return "video/3gpp2";
+    }
+    if(brand.startsWith("3gp")) {
+        return "video/3gpp";
+    }
+    // heif, avif, jpeg2000 and others are left to exiftool
+    return mp4_brands.contains(brand) ? "video/mp4" : "";
+}
+
+bool readIsoBmff(QFile& file, QMap<QString, QString>& tags, bool& has_unparsed) {
+    qint64 file_size = file.size();
+    qint64 pos = 0;
+    QString mime_type;
+    QByteArray moov;
+
+    while(pos + 8 <= file_size && file.seek(pos)) {
+        QByteArray header = file.read(16);
+        ByteReader r {header};
+        if(!r.has(0, 8)) {
+            break;
+        }
+        quint64 size = r.u32(0);
+        QByteArray type = header.mid(4, 4);
+        qint64 header_size = 8;
+        if(size == 1) {
+            if(!r.has(0, 16)) {
+                break;
+            }
+            size = r.u64(8);
+            header_size = 16;
+        } else if(size == 0) {
+            size = file_size - pos;
+        }
+        if(size < (quint64)header_size) {
+            break;
+        }
+
+        if(pos == 0) {
+            mime_type = isoBmffMimeType(type, header.mid(8, 4));
+            if(mime_type.isEmpty()) {
+                return false;
+            }
+        }
+
+        if(type == "moov") {
+            qint64 moov_size = size - header_size;
+            if(moov_size > kMaxMoovSize || !file.seek(pos + header_size)) {
+                return false;
+            }
+            moov = file.read(moov_size);
+            break;
+        }
+        pos += size;
+    }
+
+    if(mime_type.isEmpty() || moov.isEmpty()) {
+        return false;
+    }
+
+    insertTag(tags, "MIMEType", mime_type);
+    parseMoov(moov, tags, has_unparsed);
+    // exiftool finds the date in atoms we don't read (e.g. the XMP uuid box)
+    has_unparsed = has_unparsed || !tags.contains("MediaCreateDate");
+    return true;
+}
+
+#pragma endregion}
+
+}
+
+bool NativeMetadata::readTags(const QString& full_path, QMap<QString, QString>& tags) {
+    QFile file(full_path);
+    if(!file.open(QIODevice::ReadOnly)) {
+        return false;
+    }
+
+    QByteArray magic = file.read(8);
+    bool parsed = false;
+    // fields may be in metadata only exiftool reads (XMP, QuickTime keys)
+    bool has_unparsed = false;
+
+    if(magic.startsWith("\xFF\xD8")) {
+        parsed = readJpeg(file, tags, has_unparsed);
+        insertTag(tags, "MIMEType", "image/jpeg");
+    } else if(magic.startsWith("\x89PNG\r\n\x1A\n")) {
+        parsed = readPng(file, tags, has_unparsed);
+        insertTag(tags, "MIMEType", "image/png");
+    } else if(magic.size() == 8) {
+        parsed = readIsoBmff(file, tags, has_unparsed);
+    }
+
+    if(!parsed || has_unparsed) {
+        tags.clear();
+        return false;
+    }
+
+    insertTag(tags, "FileModifyDate", QFileInfo(file).lastModified().toString("yyyy:MM:dd HH:mm:ss"));
+    return true;
+}
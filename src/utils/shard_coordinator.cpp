@@ -0,0 +1,343 @@
+#include "shard_coordinator.h"
+#include "external_sorter.h"
+#include "file_table.h"
+#include "gutils.h"
+
+#include <QCoreApplication>
+#include <QJsonDocument>
+#include <QSqlQuery>
+#include <QSqlError>
+#include <QDir>
+#include <QDebug>
+
+namespace {
+
+// statements copying one attached partial index ("shard") into index.db
+// files that changed since they were indexed lose their metadata and thumbnails, like in DbWriter
+const QStringList kMergeStatements = {
+    "DROP TABLE IF EXISTS temp.shard_files",
+    "INSERT OR IGNORE INTO directories (path) SELECT path FROM shard.directories",
+    "CREATE TEMP TABLE shard_files AS "
+    "SELECT d.id AS dir_id, f.name, f.size, f.mtime, f.inode, h.hash, h.partial_hash, h.perceptual_hash "
+    "FROM shard.files f JOIN shard.directories sd ON sd.id = f.dir_id JOIN directories d ON d.path = sd.path "
+    "JOIN shard.hashes h ON h.file_id = f.id",
+    "DELETE FROM metadata WHERE file_id IN (SELECT m.id FROM files m JOIN temp.shard_files s ON s.dir_id = m.dir_id AND s.name = m.name "
+    "WHERE s.size IS NOT m.size OR s.mtime IS NOT m.mtime)",
+    "DELETE FROM thumbnails WHERE file_id IN (SELECT m.id FROM files m JOIN temp.shard_files s ON s.dir_id = m.dir_id AND s.name = m.name "
+    "WHERE s.size IS NOT m.size OR s.mtime IS NOT m.mtime)",
+    "INSERT INTO files (dir_id, name, size, mtime, inode) SELECT dir_id, name, size, mtime, inode FROM temp.shard_files WHERE true "
+    "ON CONFLICT(dir_id, name) DO UPDATE SET size = excluded.size, mtime = excluded.mtime, inode = excluded.inode",
+    "INSERT OR REPLACE INTO hashes (file_id, hash, partial_hash, perceptual_hash) "
+    "SELECT m.id, s.hash, s.partial_hash, s.perceptual_hash FROM temp.shard_files s JOIN files m ON m.dir_id = s.dir_id AND m.name = s.name",
+    "DROP TABLE temp.shard_files"
+};
+
+}
+
+ShardCoordinator::ShardCoordinator(const Options& options)
+    : options(options), work_dir(options.work_dir + "/disk_deduper_shards_XXXXXX") {
+    this->options.workers = qMax(this->options.workers, 1);
+}
+
+ShardCoordinator::~ShardCoordinator() {
+    stopWorkers();
+}
+
+bool ShardCoordinator::sendMessage(QLocalSocket& socket, const QJsonObject& message) {
+    socket.write(QJsonDocument(message).toJson(QJsonDocument::Compact) + "\n");
+    while(socket.bytesToWrite() > 0) {
+        if(!socket.waitForBytesWritten(-1)) {
+            qCritical() << "Failed sending shard message:" << socket.errorString();
+            return false;
+        }
+    }
+    return true;
+}
+
+bool ShardCoordinator::readMessage(QLocalSocket& socket, QJsonObject& message) {
+    while(!socket.canReadLine()) {
+        if(!socket.waitForReadyRead(-1)) {
+            qCritical() << "Failed reading shard message:" << socket.errorString();
+            return false;
+        }
+    }
+    message = QJsonDocument::fromJson(socket.readLine()).object();
+    return !message.isEmpty();
+}
+
+QString ShardCoordinator::workPath(const QString& name, int shard) const {
+    return work_dir.filePath(shard < 0 ? name : QString("shard_%1_%2").arg(shard).arg(name));
+}
+
+bool ShardCoordinator::startWorkers() {
+    if(!work_dir.isValid()) {
+        qCritical() << "Failed creating shard directory in" << options.work_dir << ":" << work_dir.errorString();
+        return false;
+    }
+
+    QString server_name = QString("disk_deduper_shards_%1").arg(QCoreApplication::applicationPid());
+    QLocalServer::removeServer(server_name);
+    if(!server.listen(server_name)) {
+        qCritical() << "Failed starting shard server:" << server.errorString();
+        return false;
+    }
+
+    workers.resize(options.workers);
+    for(int shard = 0; shard < options.workers; shard++) {
+        Worker& worker = workers[shard];
+        worker.index_path = workPath("index.db", shard);
+        worker.process = std::make_unique<QProcess>();
+        worker.process->setProcessChannelMode(QProcess::ForwardedChannels);
+        worker.process->start(QCoreApplication::applicationFilePath(),
+                              {"--shard-worker", server.fullServerName(), QString::number(shard)});
+        if(!worker.process->waitForStarted()) {
+            qCritical() << "Failed starting shard worker:" << worker.process->errorString();
+            return false;
+        }
+    }
+
+    // workers say which shard they are once connected
+    for(int connected = 0; connected < options.workers; connected++) {
+        if(!server.hasPendingConnections() && !server.waitForNewConnection(connect_timeout_ms)) {
+            qCritical() << "Shard workers did not connect:" << server.errorString();
+            return false;
+        }
+        QLocalSocket* socket = server.nextPendingConnection();
+        QJsonObject hello;
+        if(!readMessage(*socket, hello) || hello["type"].toString() != "hello") {
+            qCritical() << "Unexpected message from shard worker";
+            return false;
+        }
+        int shard = hello["shard"].toInt(-1);
+        if(shard < 0 || shard >= options.workers || workers[shard].socket) {
+            qCritical() << "Unexpected shard worker" << shard;
+            return false;
+        }
+        workers[shard].socket = socket;
+    }
+    return true;
+}
+
+void ShardCoordinator::stopWorkers() {
+    for(auto& worker: workers) {
+        if(worker.socket && worker.socket->state() == QLocalSocket::ConnectedState) {
+            sendMessage(*worker.socket, {{"type", "quit"}});
+        }
+    }
+    for(auto& worker: workers) {
+        if(!worker.process || worker.process->state() == QProcess::NotRunning) {
+            worker.socket = nullptr;
+            continue;
+        }
+        // a worker that was never accepted (startWorkers failed) waits for messages forever
+        // the others flush their partial index before exiting
+        if(!worker.socket || !worker.process->waitForFinished(stop_timeout_ms)) {
+            worker.process->kill();
+            worker.process->waitForFinished();
+        }
+        worker.socket = nullptr;
+    }
+}
+
+QVector<QJsonArray> ShardCoordinator::shardUnits() const {
+    QVector<QPair<QString, bool>> units;
+    for(auto& root: options.roots) {
+        if(options.roots.size() >= options.workers) {
+            units.append({root, true});
+            continue;
+        }
+        // the files directly in root, the subfolders are spread over the workers
+        units.append({root, false});
+        QDir dir(root);
+        dir.setFilter(QDir::Dirs | QDir::NoDotAndDotDot | QDir::NoSymLinks);
+        for(auto& sub_dir: dir.entryInfoList()) {
+            if(!options.blacklisted_dirs.contains(sub_dir.absoluteFilePath())) {
+                units.append({sub_dir.absoluteFilePath(), true});
+            }
+        }
+    }
+
+    QVector<QJsonArray> shards(options.workers);
+    for(int i = 0; i < units.size(); i++) {
+        shards[i % options.workers].append(QJsonObject{{"path", units[i].first}, {"recursive", units[i].second}});
+    }
+    return shards;
+}
+
+bool ShardCoordinator::runPhase(const QString& name, const std::function<QJsonObject(int shard)>& message,
+                                const std::function<void(const QString& status)>& status, QVector<QJsonObject>& replies) {
+    for(int shard = 0; shard < options.workers; shard++) {
+        if(!sendMessage(*workers[shard].socket, message(shard))) {
+            return false;
+        }
+    }
+    replies.resize(options.workers);
+    for(int shard = 0; shard < options.workers; shard++) {
+        status(QString("Shard workers: %1 (%2 of %3 done)").arg(name).arg(shard).arg(options.workers));
+        if(!readMessage(*workers[shard].socket, replies[shard])) {
+            return false;
+        }
+        if(replies[shard]["type"].toString() != "done") {
+            qCritical() << QString("Shard %1 failed %2: %3").arg(shard).arg(name, replies[shard]["message"].toString());
+            return false;
+        }
+    }
+    return true;
+}
+
+bool ShardCoordinator::writeRepeatedKeys(const QStringList& runs, int key_size, const QString& keys_path) {
+    ExternalSorter merged(work_dir.path(), key_size, options.memory_budget_bytes);
+    for(auto& run: runs) {
+        merged.addRun(run);
+    }
+    if(!merged.finish()) {
+        return false;
+    }
+
+    QFile file(keys_path);
+    if(!file.open(QIODevice::WriteOnly)) {
+        qCritical() << "Failed writing" << keys_path << ":" << file.errorString();
+        return false;
+    }
+    QDataStream stream(&file);
+    QByteArray key;
+    QByteArray previous_key;
+    QString path;
+    qint64 keys = 0;
+    while(merged.nextDuplicate(key, path)) {
+        if(key != previous_key) {
+            if(!ExternalSorter::writeRecord(stream, key, QString())) {
+                qCritical() << "Failed writing" << keys_path << ":" << file.errorString();
+                return false;
+            }
+            previous_key = key;
+            keys ++;
+        }
+    }
+    if(merged.hasError()) {
+        return false;
+    }
+    qInfo() << keys << "keys repeat across shards";
+    return true;
+}
+
+bool ShardCoordinator::run(const std::function<void(const QString& status)>& status) {
+    status("Starting shard workers");
+    if(!startWorkers()) {
+        return false;
+    }
+
+    const QVector<QJsonArray> units = shardUnits();
+    QVector<QJsonObject> replies;
+    QStringList runs;
+
+    // (size, path) of every file
+    bool ok = runPhase("enumerating", [this, &units](int shard) {
+        return QJsonObject{
+            {"type", "enumerate"},
+            {"units", units[shard]},
+            {"blacklisted_dirs", QJsonArray::fromStringList(options.blacklisted_dirs)},
+            {"extensions", QJsonArray::fromStringList(options.extensions)},
+            {"extension_filter_state", options.extension_filter_state},
+            {"memory_budget_bytes", options.memory_budget_bytes / options.workers},
+            {"index", workers[shard].index_path},
+            {"output", workPath("sizes.run", shard)}
+        };
+    }, status, replies);
+    if(!ok) {
+        return false;
+    }
+    for(int shard = 0; shard < options.workers; shard++) {
+        total_files += replies[shard]["files"].toVariant().toLongLong();
+        total_bytes += replies[shard]["bytes"].toVariant().toLongLong();
+        runs.append(workPath("sizes.run", shard));
+    }
+    qInfo() << QString("Shard workers enumerated %1 files (%2)").arg(total_files).arg(FileUtils::bytesToReadable(total_bytes));
+
+    // files sharing a size get a partial hash, files sharing a size and partial hash get a full hash
+    const QList<QPair<QString, QString>> hash_phases = {{"partial", "partial.run"}, {"full", "hashes.run"}};
+    int key_size = sizeof(qint64);
+    for(auto& phase: hash_phases) {
+        const QString hash_type = phase.first;
+        const QString output_name = phase.second;
+        status("Merging shard runs");
+        QString keys_path = workPath(hash_type + ".keys");
+        if(!writeRepeatedKeys(runs, key_size, keys_path)) {
+            return false;
+        }
+        QStringList inputs = runs;
+        runs.clear();
+        ok = runPhase(QString("%1 hashes").arg(hash_type), [&, this](int shard) {
+            return QJsonObject{
+                {"type", "hash"},
+                {"hash", hash_type},
+                {"input", inputs[shard]},
+                {"keys", keys_path},
+                {"key_size", key_size},
+                {"output", workPath(output_name, shard)}
+            };
+        }, status, replies);
+        if(!ok) {
+            return false;
+        }
+        for(int shard = 0; shard < options.workers; shard++) {
+            runs.append(workPath(output_name, shard));
+        }
+        key_size = sizeof(qint64) + digest_size;
+    }
+
+    // groups of the same size and hash
+    status("Merging shard hashes");
+    ExternalSorter merged(work_dir.path(), key_size, options.memory_budget_bytes);
+    for(auto& run: runs) {
+        merged.addRun(run);
+    }
+    if(!merged.finish()) {
+        return false;
+    }
+    QByteArray key;
+    QString path;
+    while(merged.nextDuplicate(key, path)) {
+        if(duplicate_groups.isEmpty() || duplicate_groups.last().first != key) {
+            duplicate_groups.append({key, {}});
+        }
+        duplicate_groups.last().second.append(path);
+    }
+    if(merged.hasError()) {
+        duplicate_groups.clear();
+        return false;
+    }
+
+    stopWorkers();
+    return true;
+}
+
+bool ShardCoordinator::mergePartialIndexes(QSqlDatabase db) {
+    bool ok = true;
+    for(auto& worker: workers) {
+        if(!QFile::exists(worker.index_path)) {
+            continue;
+        }
+        QSqlQuery attach(db);
+        attach.prepare("ATTACH DATABASE ? AS shard");
+        attach.bindValue(0, worker.index_path);
+        if(!DbUtils::execQuery(attach)) {
+            ok = false;
+            continue;
+        }
+        // a shard is merged completely or not at all
+        bool merged = db.transaction();
+        for(auto& statement: kMergeStatements) {
+            merged = merged && DbUtils::execQuery(db, statement);
+        }
+        if(merged && db.commit()) {
+            qInfo() << "Merged partial index" << worker.index_path;
+        } else {
+            qCritical() << "Failed merging partial index" << worker.index_path << ":" << db.lastError();
+            db.rollback();
+            ok = false;
+        }
+        DbUtils::execQuery(db, "DETACH DATABASE shard");
+    }
+    return ok;
+}
@@ -0,0 +1,190 @@
+#include "shard_worker.h"
+#include "shard_coordinator.h"
+#include "external_sorter.h"
+#include "file_table.h"
+#include "db_writer.h"
+#include "gutils.h"
+
+#include <QLocalSocket>
+#include <QFileInfo>
+#include <QDir>
+#include <QDebug>
+
+#include <cstring>
+
+namespace {
+
+const int kConnectTimeoutMs = 30000;
+// files hashed at once
+const int kHashBatchSize = 4096;
+
+struct WorkerState {
+    qint64 memory_budget_bytes = 64 * 1024 * 1024;
+    // the shard's partial index
+    uptr<DbWriter> db_writer;
+};
+
+QJsonObject error(const QString& message) {
+    qCritical() << message;
+    return {{"type", "error"}, {"message", message}};
+}
+
+QJsonObject enumerate(const QJsonObject& message, WorkerState& state) {
+    state.memory_budget_bytes = message["memory_budget_bytes"].toVariant().toLongLong();
+    state.db_writer = std::make_unique<DbWriter>(message["index"].toString());
+
+    QString output = message["output"].toString();
+    QStringList blacklisted_dirs = message["blacklisted_dirs"].toVariant().toStringList();
+    QStringList extensions = message["extensions"].toVariant().toStringList();
+    auto filter_state = (FileUtils::ExtenstionFilterState)message["extension_filter_state"].toInt();
+
+    ExternalSorter by_size(QFileInfo(output).absolutePath(), sizeof(qint64), state.memory_budget_bytes);
+    bool ok = true;
+    qint64 files = 0;
+    qint64 bytes = 0;
+    auto add_files = [&](const QString&, const QFileInfoList& infos) {
+        for(const auto& info: infos) {
+            ok = ok && by_size.add(ExternalSorter::sizeKey(info.size()), info.absoluteFilePath());
+            files ++;
+            bytes += info.size();
+        }
+    };
+
+    for(const auto& unit: message["units"].toArray()) {
+        QString path = unit.toObject()["path"].toString();
+        if(unit.toObject()["recursive"].toBool()) {
+            FileUtils::walkDirByDirectory(path, blacklisted_dirs, extensions, filter_state, add_files);
+        } else {
+            QDir dir(path);
+            dir.setFilter(QDir::Files | QDir::NoSymLinks);
+            QFileInfoList infos;
+            for(const auto& info: dir.entryInfoList()) {
+                if(FileUtils::passesExtensionFilter(info.fileName(), extensions, filter_state)) {
+                    infos.append(info);
+                }
+            }
+            add_files(path, infos);
+        }
+    }
+
+    if(!ok || !by_size.writeTo(output)) {
+        return error("Failed writing " + output);
+    }
+    return {{"type", "done"}, {"files", files}, {"bytes", bytes}};
+}
+
+QJsonObject hash(const QJsonObject& message, WorkerState& state) {
+    if(!state.db_writer) {
+        return error("Files have to be enumerated before they are hashed");
+    }
+    File::HashType hash_type = message["hash"].toString() == "partial" ? File::PARTIAL : File::FULL;
+    int key_size = message["key_size"].toInt();
+    QString output_path = message["output"].toString();
+    QString sort_dir = QFileInfo(output_path).absolutePath();
+
+    ExternalSorter input(sort_dir, key_size, state.memory_budget_bytes);
+    input.addRun(message["input"].toString());
+    ExternalSorter keys(sort_dir, key_size, state.memory_budget_bytes);
+    keys.addRun(message["keys"].toString());
+    ExternalSorter output(sort_dir, sizeof(qint64) + digest_size, state.memory_budget_bytes);
+    if(!input.finish() || !keys.finish()) {
+        return error("Failed reading " + message["input"].toString());
+    }
+
+    bool ok = true;
+    qint64 hashed = 0;
+    MultiFile batch;
+    auto hash_batch = [&]() {
+        // batch doesn't change while the hashes are loaded
+        QVector<QFuture<bool>> futures;
+        for(auto& file: batch) {
+            futures.append(file.loadHash(hash_type));
+        }
+        for(int i = 0; i < batch.size(); i++) {
+            File& file = batch[i];
+            if(futures[i].result()) {
+                file.saveHashToDb(state.db_writer.get());
+            }
+            const QByteArray& digest = hash_type == File::PARTIAL ? file.partial_hash : file.hash;
+            // unreadable files can't be compared
+            if(digest.size() == digest_size) {
+                ok = ok && output.add(ExternalSorter::sizeKey(file.size_bytes) + digest, file.full_path);
+            }
+        }
+        hashed += batch.size();
+        batch.clear();
+    };
+
+    // both runs are sorted by key, so the files to hash are found by walking them side by side
+    QByteArray key;
+    QString path;
+    QByteArray wanted_key;
+    QString unused;
+    bool has_wanted = keys.next(wanted_key, unused);
+    while(ok && has_wanted && input.next(key, path)) {
+        while(has_wanted && std::memcmp(wanted_key.constData(), key.constData(), key_size) < 0) {
+            has_wanted = keys.next(wanted_key, unused);
+        }
+        if(!has_wanted || wanted_key != key) {
+            continue;
+        }
+        File file(path);
+        // the partial hash is part of the key, it's saved together with the full hash
+        if(key_size == (int)(sizeof(qint64) + digest_size)) {
+            file.partial_hash = key.mid(sizeof(qint64));
+        }
+        batch.append(file);
+        if(batch.size() >= kHashBatchSize) {
+            hash_batch();
+        }
+    }
+    if(input.hasError() || keys.hasError()) {
+        return error("Failed reading " + (input.hasError() ? message["input"].toString() : message["keys"].toString()));
+    }
+    hash_batch();
+
+    if(!ok || !output.writeTo(output_path)) {
+        return error("Failed writing " + output_path);
+    }
+    return {{"type", "done"}, {"files", hashed}};
+}
+
+}
+
+int ShardWorker::run(const QString& server_name, int shard) {
+    QLocalSocket socket;
+    socket.connectToServer(server_name);
+    if(!socket.waitForConnected(kConnectTimeoutMs)) {
+        qCritical() << "Shard worker could not connect to" << server_name << ":" << socket.errorString();
+        return 1;
+    }
+    if(!ShardCoordinator::sendMessage(socket, {{"type", "hello"}, {"shard", shard}})) {
+        return 1;
+    }
+
+    WorkerState state;
+    QJsonObject message;
+    while(ShardCoordinator::readMessage(socket, message)) {
+        QString type = message["type"].toString();
+        if(type == "quit") {
+            break;
+        }
+        QJsonObject reply;
+        if(type == "enumerate") {
+            reply = enumerate(message, state);
+        } else if(type == "hash") {
+            reply = hash(message, state);
+        } else {
+            reply = error("Unknown message " + type);
+        }
+        if(!ShardCoordinator::sendMessage(socket, reply)) {
+            break;
+        }
+    }
+
+    // the partial index has to be complete when the coordinator merges it
+    if(state.db_writer) {
+        state.db_writer->flush();
+    }
+    return 0;
+}
@@ -0,0 +1,131 @@
+#include "sort_grouping.h"
+
+#include <QtConcurrent/QtConcurrent>
+
+#include <algorithm>
+#include <cstring>
+
+namespace {
+
+const int kRadix = 256;
+// the most significant key byte partitions the records, the other 7 key bytes and 8 size bytes are sorted by
+const int kDigits = 15;
+
+quint8 digit(const SortGrouping::Record& record, int d) {
+    if(d < 7) {
+        return record.key >> (8 * d);
+    }
+    return quint64(record.size) >> (8 * (d - 7));
+}
+
+// lsd radix sort of one partition, buffer is scratch space of the same size
+void radixSort(SortGrouping::Record* data, SortGrouping::Record* buffer, int count) {
+    SortGrouping::Record* from = data;
+    SortGrouping::Record* to = buffer;
+    for(int d = 0; d < kDigits; d++) {
+        int offsets[kRadix] = {};
+        for(int i = 0; i < count; i++) {
+            offsets[digit(from[i], d)] ++;
+        }
+        // all records share this digit (high size bytes usually do)
+        if(offsets[digit(from[0], d)] == count) {
+            continue;
+        }
+        int sum = 0;
+        for(auto& offset: offsets) {
+            int bucket_size = offset;
+            offset = sum;
+            sum += bucket_size;
+        }
+        for(int i = 0; i < count; i++) {
+            to[offsets[digit(from[i], d)]++] = from[i];
+        }
+        std::swap(from, to);
+    }
+    if(from != data) {
+        std::memcpy(data, from, count * sizeof(SortGrouping::Record));
+    }
+}
+
+}
+
+quint64 SortGrouping::keyOf(const Digest& digest) {
+    quint64 key;
+    std::memcpy(&key, digest.data(), sizeof(key));
+    return key;
+}
+
+quint64 SortGrouping::keyOf(const QString& string) {
+    // fnv-1a, the top byte has to be well distributed since it picks the partition
+    quint64 key = 14695981039346656037ULL;
+    for(QChar c: string) {
+        key ^= c.unicode();
+        key *= 1099511628211ULL;
+    }
+    return key ^ (key >> 32);
+}
+
+QVector<FileIndexes> SortGrouping::findGroups(QVector<Record>& records, const std::function<bool (quint32, quint32)>& same_key) {
+    QVector<FileIndexes> groups;
+    if(records.size() < 2) {
+        return groups;
+    }
+
+    // stable msd partition on the top key byte, partitions are sorted in parallel
+    QVector<Record> partitioned(records.size());
+    int offsets[kRadix + 1] = {};
+    for(auto& record: records) {
+        offsets[(record.key >> 56) + 1] ++;
+    }
+    for(int i = 0; i < kRadix; i++) {
+        offsets[i + 1] += offsets[i];
+    }
+    QVector<QPair<int, int>> partitions;
+    for(int i = 0; i < kRadix; i++) {
+        if(offsets[i + 1] - offsets[i] > 1) {
+            partitions.append({offsets[i], offsets[i + 1] - offsets[i]});
+        }
+    }
+    for(auto& record: records) {
+        partitioned[offsets[record.key >> 56]++] = record;
+    }
+    // records is the scratch space from here on
+    QtConcurrent::blockingMap(partitions, [&partitioned, &records](const QPair<int, int>& partition) {
+        radixSort(partitioned.data() + partition.first, records.data() + partition.first, partition.second);
+    });
+
+    // runs of equal records
+    for(int start = 0; start < partitioned.size();) {
+        int end = start + 1;
+        while(end < partitioned.size() && partitioned[end].key == partitioned[start].key
+              && partitioned[end].size == partitioned[start].size) {
+            end ++;
+        }
+        if(end - start > 1) {
+            // almost always a single group, unless key prefixes collide
+            QVector<FileIndexes> run_groups;
+            for(int i = start; i < end; i++) {
+                quint32 index = partitioned[i].index;
+                auto group = std::find_if(run_groups.begin(), run_groups.end(), [&same_key, index](const FileIndexes& group) {
+                    return same_key(group.first(), index);
+                });
+                if(group != run_groups.end()) {
+                    group->append(index);
+                } else {
+                    run_groups.append({index});
+                }
+            }
+            for(auto& group: run_groups) {
+                if(group.size() > 1) {
+                    groups.append(group);
+                }
+            }
+        }
+        start = end;
+    }
+
+    std::sort(groups.begin(), groups.end(), [](const FileIndexes& a, const FileIndexes& b) {
+        return a.first() < b.first();
+    });
+    return groups;
+}
@@ -0,0 +1,158 @@
+#include "stats_aggregator.h"
+
+#include "gutils.h"
+
+#include <QtConcurrent/QtConcurrent>
+#include <QSqlQuery>
+#include <QSqlError>
+
+#include <algorithm>
+
+StatsAggregator::StatsAggregator(const QVector<QString>& meta_fields)
+    : meta_fields(meta_fields), fields_stats(meta_fields.size()) {
+    for(auto& meta_field: meta_fields) {
+        meta_field_indexes.append(getMetaFieldIndex(meta_field));
+    }
+}
+
+void StatsAggregator::add(const File& file) {
+    for(int i = 0; i < meta_field_indexes.size(); i++) {
+        ValueTotals& totals = fields_stats[i][file.metadata[meta_field_indexes[i]]];
+        totals.count ++;
+        totals.total_size_bytes += file.size_bytes;
+    }
+}
+
+void StatsAggregator::add(int selected_field, const QString& value, quint32 count, qint64 total_size_bytes) {
+    ValueTotals& totals = fields_stats[selected_field][value];
+    totals.count += count;
+    totals.total_size_bytes += total_size_bytes;
+}
+
+void StatsAggregator::merge(const StatsAggregator& other) {
+    for(int i = 0; i < fields_stats.size(); i++) {
+        for(auto it = other.fields_stats[i].cbegin(); it != other.fields_stats[i].cend(); it++) {
+            add(i, it.key(), it.value().count, it.value().total_size_bytes);
+        }
+    }
+}
+
+void StatsAggregator::addCachedFromDb(QSqlDatabase db, const MultiFile& files, MultiFile& uncached_files, FileQuantitySizeCounter& cached_files) {
+
+    // scanned files go into a temporary table, so that they can be joined against the cache
+    // idx is the position in files
+    DbUtils::execQuery(db, "CREATE TEMP TABLE IF NOT EXISTS scan_paths (idx INTEGER PRIMARY KEY, dir TEXT, name TEXT, size INTEGER, mtime INTEGER)");
+    DbUtils::execQuery(db, "DELETE FROM scan_paths");
+
+    QVariantList indexes;
+    QVariantList dirs;
+    QVariantList names;
+    QVariantList sizes;
+    QVariantList mtimes;
+    for(int i = 0; i < files.size(); i++) {
+        indexes.append(i);
+        dirs.append(files[i].path_without_name);
+        names.append(files[i].name);
+        sizes.append(files[i].size_bytes);
+        mtimes.append(files[i].mtime_ms);
+    }
+
+    QSqlQuery insert_query(db);
+    insert_query.prepare("INSERT INTO scan_paths (idx, dir, name, size, mtime) VALUES (?, ?, ?, ?, ?)");
+    for(auto values: {&indexes, &dirs, &names, &sizes, &mtimes}) {
+        insert_query.addBindValue(*values);
+    }
+    // only the temp database is written, so this doesn't block the db writer
+    db.transaction();
+    bool inserted = insert_query.execBatch();
+    db.commit();
+    if(!inserted) {
+        qWarning() << "Failed filling scan paths:" << insert_query.lastError().text();
+        uncached_files += files;
+        return;
+    }
+
+    // cached metadata is only valid if the file didn't change (same as File::loadMetadataFromDb)
+    const QString join = "FROM scan_paths s JOIN directories d ON d.path = s.dir "
+                         "JOIN files f ON f.dir_id = d.id AND f.name = s.name "
+                         "JOIN metadata m ON m.file_id = f.id "
+                         "WHERE f.size = s.size AND (f.mtime IS NULL OR f.mtime = s.mtime)";
+
+    QVector<bool> cached(files.size(), false);
+    QSqlQuery cached_query(db);
+    cached_query.setForwardOnly(true);
+    cached_query.prepare("SELECT s.idx " + join);
+    DbUtils::execQuery(cached_query);
+    while(cached_query.next()) {
+        cached[cached_query.value(0).toInt()] = true;
+    }
+
+    for(int i = 0; i < files.size(); i++) {
+        File::metadata_cache.count(cached[i]);
+        if(cached[i]) {
+            cached_files += files[i];
+        } else {
+            uncached_files.append(files[i]);
+        }
+    }
+
+    // counts and sizes are computed by sqlite, only distinct values are transferred
+    // user remaps are applied afterwards, add() merges values that map to the same name
+    for(int i = 0; i < meta_fields.size(); i++) {
+        QString column = QString(meta_fields.at(i)).replace(" ", "_");
+        QSqlQuery stats_query(db);
+        stats_query.setForwardOnly(true);
+        stats_query.prepare(QString("SELECT m.%1, COUNT(*), SUM(f.size) %2 GROUP BY m.%1").arg(column, join));
+        DbUtils::execQuery(stats_query);
+        while(stats_query.next()) {
+            add(i, File::remapMetaValue(meta_field_indexes[i], stats_query.value(0).toString()),
+                stats_query.value(1).toUInt(), stats_query.value(2).toLongLong());
+        }
+    }
+
+    DbUtils::execQuery(db, "DELETE FROM scan_paths");
+}
+
+StatsAggregator StatsAggregator::aggregate(const QVector<QString>& meta_fields, const MultiFile& files, int workers) {
+    workers = qBound(1, workers, qMax(files.size(), 1));
+    int chunk_size = (files.size() + workers - 1) / workers;
+
+    QVector<QFuture<StatsAggregator>> futures;
+    for(int start = 0; start < files.size(); start += chunk_size) {
+        int end = qMin(start + chunk_size, files.size());
+        futures.append(QtConcurrent::run([&meta_fields, &files, start, end]() {
+            StatsAggregator partial(meta_fields);
+            for(int i = start; i < end; i++) {
+                partial.add(files[i]);
+            }
+            return partial;
+        }));
+    }
+
+    StatsAggregator stats(meta_fields);
+    for(auto& future: futures) {
+        stats.merge(future.result());
+    }
+    return stats;
+}
+
+QVector<NamedCountableQStringList> StatsAggregator::results(const FileQuantitySizeCounter& total_files) const {
+    QVector<NamedCountableQStringList> meta_fields_stats;
+
+    for(int i = 0; i < meta_fields.size(); i++) {
+        CountableQStringList metadata_array;
+        metadata_array.reserve(fields_stats[i].size());
+        for(auto it = fields_stats[i].cbegin(); it != fields_stats[i].cend(); it++) {
+            // calculate relative percentages
+            metadata_array.append({it.key(), it.value().count, it.value().total_size_bytes,
+                                   it.value().count / (double)total_files.num() * 100,
+                                   (double)(it.value().total_size_bytes / (long double)total_files.size() * 100)});
+        }
+        std::sort(metadata_array.begin(), metadata_array.end(), [](const CountableQString& a, const CountableQString& b) {
+            return a.count > b.count;
+        });
+        meta_fields_stats.append({meta_fields.at(i), metadata_array});
+    }
+
+    return meta_fields_stats;
+}
@@ -0,0 +1,16 @@
+#include "tests.h"
+
+#include <QGuiApplication>
+
+int main(int argc, char *argv[]) {
+    // File still needs a gui application for its pixmap, no windows are opened
+    qputenv("QT_QPA_PLATFORM", "offscreen");
+    QGuiApplication a(argc, argv);
+
+    int failed = 0;
+    failed += runFlatGroupMapTests(argc, argv);
+    failed += runSortGroupingTests(argc, argv);
+    failed += runExternalSorterTests(argc, argv);
+    failed += runHashCatalogTests(argc, argv);
+    return failed;
+}
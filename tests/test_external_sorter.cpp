@@ -0,0 +1,164 @@
+#include "tests.h"
+#include "external_sorter.h"
+
+#include <QtTest>
+#include <QtEndian>
+#include <QTemporaryDir>
+#include <QRandomGenerator>
+
+#include <algorithm>
+
+namespace {
+
+const int kKeySize = sizeof(qint64);
+
+QString pathOf(qint64 size) {
+    return QString("/files/%1").arg(size);
+}
+
+// all records in key order, false if they aren't sorted or a run couldn't be read
+bool readAll(ExternalSorter& sorter, QVector<qint64>& sizes) {
+    QByteArray key;
+    QByteArray previous_key;
+    QString path;
+    while(sorter.next(key, path)) {
+        if(!previous_key.isEmpty() && key < previous_key) {
+            return false;
+        }
+        sizes.append(qFromBigEndian<qint64>(key.constData()));
+        previous_key = key;
+    }
+    return !sorter.hasError();
+}
+
+}
+
+class ExternalSorterTest : public QObject {
+    Q_OBJECT
+
+private slots:
+    void sortsInMemory();
+    void mergesInSeveralPasses();
+    void findsDuplicates();
+    void mergesRunsOfOtherSorters();
+    void reportsTruncatedRuns();
+
+private:
+    QTemporaryDir temp_dir;
+};
+
+void ExternalSorterTest::sortsInMemory() {
+    ExternalSorter sorter(temp_dir.path(), kKeySize, 1024 * 1024);
+    const QVector<qint64> sizes = {5, 1, 4, 1, 3};
+    for(auto size: sizes) {
+        QVERIFY(sorter.add(ExternalSorter::sizeKey(size), pathOf(size)));
+    }
+    QVERIFY(sorter.finish());
+    QCOMPARE(sorter.spilledRuns(), 0);
+
+    QVector<qint64> sorted;
+    QVERIFY(readAll(sorter, sorted));
+    QVERIFY(sorted == (QVector<qint64>{1, 1, 3, 4, 5}));
+}
+
+void ExternalSorterTest::mergesInSeveralPasses() {
+    // a budget below one record spills every record, far more runs than can be merged at once
+    ExternalSorter sorter(temp_dir.path(), kKeySize, 1);
+    const int count = 300;
+    QVector<qint64> sizes;
+    for(int i = 0; i < count; i++) {
+        qint64 size = QRandomGenerator::global()->bounded(1000);
+        sizes.append(size);
+        QVERIFY(sorter.add(ExternalSorter::sizeKey(size), pathOf(size)));
+    }
+    QVERIFY(sorter.finish());
+    // the merge passes wrote runs of their own
+    QVERIFY(sorter.spilledRuns() > count);
+    QCOMPARE(sorter.recordCount(), (qint64)count);
+
+    QVector<qint64> sorted;
+    QVERIFY(readAll(sorter, sorted));
+    std::sort(sizes.begin(), sizes.end());
+    QVERIFY(sorted == sizes);
+}
+
+void ExternalSorterTest::findsDuplicates() {
+    ExternalSorter sorter(temp_dir.path(), kKeySize, 256);
+    const QVector<qint64> sizes = {7, 2, 9, 7, 3, 2, 7};
+    for(int i = 0; i < sizes.size(); i++) {
+        QVERIFY(sorter.add(ExternalSorter::sizeKey(sizes[i]), QString("/files/%1").arg(i)));
+    }
+    QVERIFY(sorter.finish());
+
+    QVector<qint64> duplicates;
+    QByteArray key;
+    QString path;
+    while(sorter.nextDuplicate(key, path)) {
+        duplicates.append(qFromBigEndian<qint64>(key.constData()));
+    }
+    QVERIFY(!sorter.hasError());
+    QVERIFY(duplicates == (QVector<qint64>{2, 2, 7, 7, 7}));
+}
+
+void ExternalSorterTest::mergesRunsOfOtherSorters() {
+    // the way shard workers hand their runs to the coordinator
+    QString first_run = temp_dir.filePath("first.run");
+    QString second_run = temp_dir.filePath("second.run");
+    {
+        ExternalSorter first(temp_dir.path(), kKeySize, 1024 * 1024);
+        ExternalSorter second(temp_dir.path(), kKeySize, 64);
+        for(qint64 size = 0; size < 100; size++) {
+            QVERIFY((size % 2 ? first : second).add(ExternalSorter::sizeKey(size), pathOf(size)));
+        }
+        QVERIFY(first.writeTo(first_run));
+        QVERIFY(second.writeTo(second_run));
+    }
+
+    ExternalSorter merged(temp_dir.path(), kKeySize, 1024 * 1024);
+    merged.addRun(first_run);
+    merged.addRun(second_run);
+    QVERIFY(merged.add(ExternalSorter::sizeKey(50), pathOf(50)));
+    QVERIFY(merged.finish());
+
+    QVector<qint64> sorted;
+    QVERIFY(readAll(merged, sorted));
+    QCOMPARE(sorted.size(), 101);
+    QCOMPARE(sorted.count(50), 2);
+    // runs that aren't the sorter's own are left alone
+    QVERIFY(QFile::exists(first_run));
+}
+
+void ExternalSorterTest::reportsTruncatedRuns() {
+    QString run_path = temp_dir.filePath("truncated.run");
+    {
+        ExternalSorter sorter(temp_dir.path(), kKeySize, 1024 * 1024);
+        for(qint64 size = 0; size < 100; size++) {
+            QVERIFY(sorter.add(ExternalSorter::sizeKey(size), pathOf(size)));
+        }
+        QVERIFY(sorter.writeTo(run_path));
+    }
+    // cut into the last path
+    QFile run(run_path);
+    QVERIFY(run.resize(run.size() - 3));
+
+    ExternalSorter sorter(temp_dir.path(), kKeySize, 1024 * 1024);
+    sorter.addRun(run_path);
+    QVERIFY(sorter.finish());
+    QVector<qint64> sorted;
+    QVERIFY(!readAll(sorter, sorted));
+    QVERIFY(sorter.hasError());
+    QVERIFY(sorted.size() < 100);
+
+    // a merge into another run fails instead of writing a shorter one
+    ExternalSorter rewrite(temp_dir.path(), kKeySize, 1024 * 1024);
+    rewrite.addRun(run_path);
+    rewrite.addRun(run_path);
+    QVERIFY(!rewrite.writeTo(temp_dir.filePath("rewritten.run")));
+}
+
+int runExternalSorterTests(int argc, char* argv[]) {
+    ExternalSorterTest test;
+    return QTest::qExec(&test, argc, argv);
+}
+
+#include "test_external_sorter.moc"
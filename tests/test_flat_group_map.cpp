@@ -0,0 +1,78 @@
+#include "tests.h"
+#include "flat_group_map.h"
+#include "file_table.h"
+
+#include <QtTest>
+
+namespace {
+
+Digest digestOf(quint8 first, quint8 last) {
+    Digest digest {};
+    digest[0] = first;
+    digest[digest_size - 1] = last;
+    return digest;
+}
+
+}
+
+class FlatGroupMapTest : public QObject {
+    Q_OBJECT
+
+private slots:
+    void groupsKeepInsertionOrder();
+    void findsKeysAfterRehash();
+    void separatesDigestsWithTheSameHash();
+};
+
+void FlatGroupMapTest::groupsKeepInsertionOrder() {
+    FlatGroupMap<Digest, QVector<quint32>> groups;
+    const QVector<quint8> keys = {7, 3, 7, 9, 3, 7};
+    for(int i = 0; i < keys.size(); i++) {
+        groups[digestOf(keys[i], 0)].append(i);
+    }
+
+    QCOMPARE(groups.size(), 3);
+    QVERIFY(groups.keyAt(0) == digestOf(7, 0));
+    QVERIFY(groups.keyAt(1) == digestOf(3, 0));
+    QVERIFY(groups.keyAt(2) == digestOf(9, 0));
+    QVERIFY(groups.valueAt(0) == (QVector<quint32>{0, 2, 5}));
+    QVERIFY(groups.valueAt(1) == (QVector<quint32>{1, 4}));
+    QVERIFY(groups.valueAt(2) == (QVector<quint32>{3}));
+}
+
+void FlatGroupMapTest::findsKeysAfterRehash() {
+    // far more keys than the initial capacity, the table is rehashed several times
+    FlatGroupMap<int, int> map(4);
+    const int count = 10000;
+    for(int i = 0; i < count; i++) {
+        map[i * 7919] = i;
+    }
+
+    QCOMPARE(map.size(), count);
+    for(int i = 0; i < count; i++) {
+        int* value = map.find(i * 7919);
+        QVERIFY(value);
+        QCOMPARE(*value, i);
+    }
+    QVERIFY(!map.find(-1));
+}
+
+void FlatGroupMapTest::separatesDigestsWithTheSameHash() {
+    // only the first 8 bytes are hashed, these collide and are told apart by comparing the whole digest
+    FlatGroupMap<Digest, QVector<quint32>> groups;
+    groups[digestOf(1, 1)].append(0);
+    groups[digestOf(1, 2)].append(1);
+    groups[digestOf(1, 1)].append(2);
+
+    QCOMPARE(groups.size(), 2);
+    QVERIFY(groups.valueAt(0) == (QVector<quint32>{0, 2}));
+    QVERIFY(groups.valueAt(1) == (QVector<quint32>{1}));
+    QVERIFY(groups.find(digestOf(1, 3)) == nullptr);
+}
+
+int runFlatGroupMapTests(int argc, char* argv[]) {
+    FlatGroupMapTest test;
+    return QTest::qExec(&test, argc, argv);
+}
+
+#include "test_flat_group_map.moc"
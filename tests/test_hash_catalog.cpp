@@ -0,0 +1,110 @@
+#include "tests.h"
+#include "hash_catalog.h"
+
+#include <QtTest>
+#include <QTemporaryDir>
+
+#include <cstddef>
+
+class HashCatalogTest : public QObject {
+    Q_OBJECT
+
+private slots:
+    void init();
+    void readsWhatWasWritten();
+    void rejectsCorruptHeaders_data();
+    void rejectsCorruptHeaders();
+    void rejectsShortFiles();
+
+private:
+    QTemporaryDir temp_dir;
+    QString catalog_path;
+    QString root;
+
+    // overwrites part of the catalog file at offset
+    void patch(qint64 offset, const QByteArray& bytes);
+};
+
+void HashCatalogTest::init() {
+    // every test starts with a valid catalog of three files
+    root = QDir(temp_dir.path()).absolutePath() + "/drive";
+    catalog_path = temp_dir.filePath("test." + HashCatalog::file_extension);
+
+    MultiFile files = {File(root + "/photos/b.jpg", 200, 2000), File(root + "/a.jpg", 100, 1000),
+                       File(root + "/unhashed.jpg", 300, 3000)};
+    files[0].hash = QByteArray(HashCatalog::digest_size, 'b');
+    files[0].partial_hash = QByteArray(HashCatalog::digest_size, 'p');
+    files[1].hash = QByteArray(HashCatalog::digest_size, 'a');
+    QVERIFY(HashCatalog::write(catalog_path, root, files));
+}
+
+void HashCatalogTest::patch(qint64 offset, const QByteArray& bytes) {
+    QFile file(catalog_path);
+    QVERIFY(file.open(QIODevice::ReadWrite));
+    QVERIFY(file.seek(offset));
+    QCOMPARE(file.write(bytes), (qint64)bytes.size());
+}
+
+void HashCatalogTest::readsWhatWasWritten() {
+    HashCatalog catalog;
+    QVERIFY(catalog.open(catalog_path));
+
+    // files without hashes are left out, the rest is sorted by relative path
+    QCOMPARE(catalog.size(), 2);
+    QCOMPARE(catalog.root(), root);
+    QCOMPARE(catalog.relativePath(0), QString("a.jpg"));
+    QCOMPARE(catalog.relativePath(1), QString("photos/b.jpg"));
+
+    File file = catalog.file(1);
+    QVERIFY(file.offline);
+    QCOMPARE(file.full_path, QString(root + "/photos/b.jpg"));
+    QCOMPARE(file.size_bytes, (qint64)200);
+    QCOMPARE(file.mtime_ms, (qint64)2000);
+    QCOMPARE(file.hash, QByteArray(HashCatalog::digest_size, 'b'));
+    QCOMPARE(file.partial_hash, QByteArray(HashCatalog::digest_size, 'p'));
+    QVERIFY(catalog.file(0).partial_hash.isEmpty());
+}
+
+void HashCatalogTest::rejectsCorruptHeaders_data() {
+    QTest::addColumn<int>("offset");
+    QTest::addColumn<QByteArray>("bytes");
+
+    auto value = [](auto v) { return QByteArray((const char*)&v, sizeof(v)); };
+    QTest::newRow("magic") << (int)offsetof(HashCatalog::Header, magic) << QByteArray("NOTACATL");
+    QTest::newRow("version") << (int)offsetof(HashCatalog::Header, version) << value(quint32(2));
+    QTest::newRow("entry count") << (int)offsetof(HashCatalog::Header, entry_count) << value(quint32(1000000));
+    QTest::newRow("entries inside header") << (int)offsetof(HashCatalog::Header, entries_offset) << value(quint64(8));
+    QTest::newRow("misaligned entries") << (int)offsetof(HashCatalog::Header, entries_offset)
+                                        << value(quint64(sizeof(HashCatalog::Header) + 1));
+    QTest::newRow("strings past the end") << (int)offsetof(HashCatalog::Header, strings_size) << value(quint64(1) << 40);
+    QTest::newRow("root past the strings") << (int)offsetof(HashCatalog::Header, root_len) << value(quint32(1000000));
+    QTest::newRow("volume past the strings") << (int)offsetof(HashCatalog::Header, volume_offset) << value(quint32(1000000));
+    QTest::newRow("entry path past the strings") << (int)(sizeof(HashCatalog::Header) + offsetof(HashCatalog::Entry, path_len))
+                                                 << value(quint32(1000000));
+}
+
+void HashCatalogTest::rejectsCorruptHeaders() {
+    QFETCH(int, offset);
+    QFETCH(QByteArray, bytes);
+    patch(offset, bytes);
+
+    HashCatalog catalog;
+    QVERIFY(!catalog.open(catalog_path));
+    QCOMPARE(catalog.size(), 0);
+    QVERIFY(catalog.root().isEmpty());
+}
+
+void HashCatalogTest::rejectsShortFiles() {
+    QFile file(catalog_path);
+    QVERIFY(file.resize(sizeof(HashCatalog::Header) - 1));
+
+    HashCatalog catalog;
+    QVERIFY(!catalog.open(catalog_path));
+}
+
+int runHashCatalogTests(int argc, char* argv[]) {
+    HashCatalogTest test;
+    return QTest::qExec(&test, argc, argv);
+}
+
+#include "test_hash_catalog.moc"
@@ -0,0 +1,75 @@
+#include "tests.h"
+#include "sort_grouping.h"
+
+#include <QtTest>
+
+namespace {
+
+Digest digestOf(quint8 first, quint8 last) {
+    Digest digest {};
+    digest[0] = first;
+    digest[digest_size - 1] = last;
+    return digest;
+}
+
+}
+
+class SortGroupingTest : public QObject {
+    Q_OBJECT
+
+private slots:
+    void groupsByDigestAndSize();
+    void groupsNames();
+    void ignoresSingleRecords();
+};
+
+void SortGroupingTest::groupsByDigestAndSize() {
+    // the last two digests share their key prefix with the first one, only same_key tells them apart
+    const QVector<Digest> digests = {digestOf(1, 0), digestOf(2, 0), digestOf(1, 0), digestOf(1, 0), digestOf(1, 9), digestOf(2, 0), digestOf(1, 9)};
+    const QVector<qint64> sizes = {10, 10, 10, 20, 10, 10, 10};
+
+    QVector<SortGrouping::Record> records;
+    for(int i = 0; i < digests.size(); i++) {
+        records.append({SortGrouping::keyOf(digests[i]), sizes[i], (quint32)i});
+    }
+    QVector<FileIndexes> groups = SortGrouping::findGroups(records, [&digests](quint32 a, quint32 b) {
+        return digests[a] == digests[b];
+    });
+
+    // ascending indexes, ordered by the first index of each group
+    QCOMPARE(groups.size(), 3);
+    QVERIFY(groups[0] == (FileIndexes{0, 2}));
+    QVERIFY(groups[1] == (FileIndexes{1, 5}));
+    QVERIFY(groups[2] == (FileIndexes{4, 6}));
+}
+
+void SortGroupingTest::groupsNames() {
+    const QStringList names = {"a.jpg", "b.jpg", "A.jpg", "a.jpg", "b.jpg", "a.jpg"};
+
+    QVector<SortGrouping::Record> records;
+    for(int i = 0; i < names.size(); i++) {
+        records.append({SortGrouping::keyOf(names[i]), 0, (quint32)i});
+    }
+    QVector<FileIndexes> groups = SortGrouping::findGroups(records, [&names](quint32 a, quint32 b) {
+        return names[a] == names[b];
+    });
+
+    QCOMPARE(groups.size(), 2);
+    QVERIFY(groups[0] == (FileIndexes{0, 3, 5}));
+    QVERIFY(groups[1] == (FileIndexes{1, 4}));
+}
+
+void SortGroupingTest::ignoresSingleRecords() {
+    QVector<SortGrouping::Record> records = {{SortGrouping::keyOf(digestOf(1, 0)), 10, 0}};
+    QVERIFY(SortGrouping::findGroups(records, [](quint32, quint32) { return true; }).isEmpty());
+
+    records.clear();
+    QVERIFY(SortGrouping::findGroups(records, [](quint32, quint32) { return true; }).isEmpty());
+}
+
+int runSortGroupingTests(int argc, char* argv[]) {
+    SortGroupingTest test;
+    return QTest::qExec(&test, argc, argv);
+}
+
+#include "test_sort_grouping.moc"
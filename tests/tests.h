@@ -0,0 +1,10 @@
+#ifndef TESTS_H
+#define TESTS_H
+
+// every test class has a run function called by tests/main.cpp, it returns the number of failed tests
+int runFlatGroupMapTests(int argc, char* argv[]);
+int runSortGroupingTests(int argc, char* argv[]);
+int runExternalSorterTests(int argc, char* argv[]);
+int runHashCatalogTests(int argc, char* argv[]);
+
+#endif // TESTS_H